@@ -61,6 +61,12 @@
  *****************************************************************************/
 #define USE_FCYC   0   /* cycle counter w/K-best scheme (x86 & Alpha only) */
 #define USE_ITIMER 0   /* interval timer (any Unix box) */
-#define USE_GETTOD 1   /* gettimeofday (any Unix box) */
+#define USE_GETTOD 0   /* gettimeofday (any Unix box) */
+#define USE_MONO   1   /* CLOCK_MONOTONIC_RAW, pinned, to a confidence interval (Linux) */
+
+/* USE_MONO repeats a run until the 95% confidence interval of its mean
+   time is within MONO_EPSILON of the mean, or MONO_MAXSECS are spent */
+#define MONO_EPSILON 0.02
+#define MONO_MAXSECS 2.0
 
 #endif /* __CONFIG_H */
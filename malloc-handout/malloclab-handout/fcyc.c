@@ -10,6 +10,8 @@
 #include <stdlib.h>
 #include <sys/times.h>
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "fcyc.h"
 #include "clock.h"
@@ -98,11 +100,11 @@ static int has_converged()
 }
 
 /* 
- * clear - Code to clear cache 
+ * fcyc_clear_cache - Code to clear cache 
  */
 static volatile int sink = 0;
 
-static void clear()
+void fcyc_clear_cache(void)
 {
     int x = sink;
     int *cptr, *cend;
@@ -113,6 +115,8 @@ static void clear()
 	    fprintf(stderr, "Fatal error.  Malloc returned null when trying to clear cache\n");
 	    exit(1);
 	}
+	/* Untouched pages would all read as the one shared zero page */
+	memset(cache_buf, 1, cache_bytes);
     }
     cptr = (int *) cache_buf;
     cend = cptr + cache_bytes/sizeof(int);
@@ -134,7 +138,7 @@ double fcyc(test_funct f, void *argp)
 	do {
 	    double cyc;
 	    if (clear_cache)
-		clear();
+		fcyc_clear_cache();
 	    start_comp_counter();
 	    f(argp);
 	    cyc = get_comp_counter();
@@ -144,7 +148,7 @@ double fcyc(test_funct f, void *argp)
 	do {
 	    double cyc;
 	    if (clear_cache)
-		clear();
+		fcyc_clear_cache();
 	    start_counter();
 	    f(argp);
 	    cyc = get_counter();
@@ -197,6 +201,36 @@ void set_fcyc_cache_size(int bytes)
     }
 }
 
+/*
+ * fcyc_llc_bytes - Size of the last-level data cache, from sysconf or
+ *     else sysfs, or CACHE_BYTES if neither knows
+ */
+int fcyc_llc_bytes(void)
+{
+    long bytes = 0;
+    int index;
+    char path[64], unit = 'B';
+    FILE *f;
+
+#ifdef _SC_LEVEL3_CACHE_SIZE
+    if ((bytes = sysconf(_SC_LEVEL3_CACHE_SIZE)) <= 0)
+	bytes = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+    for (index = 4; bytes <= 0 && index >= 0; index--) {
+	sprintf(path, "/sys/devices/system/cpu/cpu0/cache/index%d/size", index);
+	if ((f = fopen(path, "r")) == NULL)
+	    continue;
+	if (fscanf(f, "%ld%c", &bytes, &unit) < 1)
+	    bytes = 0;
+	else if (unit == 'K')
+	    bytes <<= 10;
+	else if (unit == 'M')
+	    bytes <<= 20;
+	fclose(f);
+    }
+    return (bytes > 0) ? (int)bytes : CACHE_BYTES;
+}
+
 /* 
  * set_fcyc_cache_block - Set size of cache block 
  *     Default = 32
@@ -13,6 +13,12 @@ typedef void (*test_funct)(void *);
 /* Compute number of cycles used by test function f */
 double fcyc(test_funct f, void* argp);
 
+/* Evict the data caches by reading a buffer of the cache size */
+void fcyc_clear_cache(void);
+
+/* Size in bytes of the last-level cache, as best it can be found */
+int fcyc_llc_bytes(void);
+
 /*********************************************************
  * Set the various parameters used by measurement routines 
  *********************************************************/
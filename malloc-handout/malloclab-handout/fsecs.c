@@ -9,6 +9,8 @@
 #include "config.h"
 
 static double Mhz;  /* estimated CPU clock frequency */
+static ftimer_stats_t last; /* the runs behind the last fsecs result */
+static fsecs_test_funct prep; /* run before each timed run, or NULL */
 
 extern int verbose; /* -v option in mdriver.c */
 
@@ -36,22 +38,74 @@ void init_fsecs(void)
 #elif USE_GETTOD
     if (verbose)
 	printf("Measuring performance with gettimeofday().\n");
+#elif USE_MONO
+    if (verbose)
+	printf("Measuring performance with CLOCK_MONOTONIC_RAW, to within %g%%.\n",
+	       MONO_EPSILON * 100);
 #endif
 }
 
+/*
+ * set_fsecs_prep - Run prep before each timed run. The fcyc timer
+ *     ignores it, since it clears the cache itself (set_fcyc_clear_cache).
+ */
+void set_fsecs_prep(fsecs_test_funct prep_arg)
+{
+    prep = prep_arg;
+}
+
+#if !USE_MONO && !USE_FCYC
+/*
+ * each_run - Time n runs of f one at a time with timer, calling prep
+ *     before each, for the timers that otherwise time n runs at once
+ */
+static double each_run(double (*timer)(ftimer_test_funct, void *, int),
+		       fsecs_test_funct f, void *argp, int n)
+{
+    double total = 0;
+    int i;
+
+    if (prep == NULL)
+	return timer(f, argp, n);
+    for (i = 0; i < n; i++) {
+	prep(argp);
+	total += timer(f, argp, 1);
+    }
+    return total / n;
+}
+#endif
+
 /*
  * fsecs - Return the running time of a function f (in seconds)
  */
 double fsecs(fsecs_test_funct f, void *argp) 
 {
+#if USE_MONO
+    return ftimer_mono(f, argp, prep, MONO_EPSILON, MONO_MAXSECS, &last);
+#else
+    last.stddev = 0;
 #if USE_FCYC
-    double cycles = fcyc(f, argp);
-    return cycles/(Mhz*1e6);
+    last.runs = 1;
+    last.min = last.mean = fcyc(f, argp)/(Mhz*1e6);
 #elif USE_ITIMER
-    return ftimer_itimer(f, argp, 10);
+    last.runs = 10;
+    last.min = last.mean = each_run(ftimer_itimer, f, argp, 10);
 #elif USE_GETTOD
-    return ftimer_gettod(f, argp, 10);
+    last.runs = 10;
+    last.min = last.mean = each_run(ftimer_gettod, f, argp, 10);
 #endif 
+    return last.mean;
+#endif
+}
+
+/*
+ * fsecs_spread - Return the spread of the runs behind the last fsecs
+ */
+void fsecs_spread(double *stddev, double *min, int *runs)
+{
+    *stddev = last.stddev;
+    *min = last.min;
+    *runs = last.runs;
 }
 
 
@@ -2,3 +2,10 @@ typedef void (*fsecs_test_funct)(void *);
 
 void init_fsecs(void);
 double fsecs(fsecs_test_funct f, void *argp);
+
+/* Run prep(argp) untimed before each timed run of fsecs, or stop with NULL */
+void set_fsecs_prep(fsecs_test_funct prep);
+
+/* Standard deviation and minimum in seconds of the runs behind the last
+   fsecs result, and their number; stddev is 0 if the timer can't tell */
+void fsecs_spread(double *stddev, double *min, int *runs);
@@ -7,11 +7,20 @@
  * Function timers that estimate the running time (in seconds) of a function f.
  *    ftimer_itimer: version that uses the interval timer
  *    ftimer_gettod: version that uses gettimeofday
+ *    ftimer_mono: version that uses CLOCK_MONOTONIC_RAW on a pinned core
  */
+#define _GNU_SOURCE  /* for sched_setaffinity and sched_getcpu */
 #include <stdio.h>
+#include <math.h>
+#include <sched.h>
+#include <time.h>
 #include <sys/time.h>
 #include "ftimer.h"
 
+#define MONO_WARMUPS   2    /* untimed runs before measuring */
+#define MONO_MINRUNS   5    /* timed runs before the interval is trusted */
+#define MONO_MAXRUNS 1000   /* stop here even if the interval is too wide */
+
 /* function prototypes */
 static void init_etime(void);
 static double get_etime(void);
@@ -52,6 +61,80 @@ double ftimer_gettod(ftimer_test_funct f, void *argp, int n)
     return (1E-3*diff);
 }
 
+/*
+ * t95 - two-sided 95% Student t quantile for df degrees of freedom;
+ *     exact to df 10 and within 0.01 of it beyond
+ */
+static double t95(int df)
+{
+    static const double t[] = {12.71, 4.30, 3.18, 2.78, 2.57, 
+			       2.45, 2.36, 2.31, 2.26, 2.23};
+
+    return (df <= 10) ? t[df - 1] : 1.96 + 2.5 / df;
+}
+
+/* 
+ * ftimer_mono - Use CLOCK_MONOTONIC_RAW to estimate the running time of
+ * f(argp), on the core the thread was running on when called. Return the
+ * mean of the timed runs, of which there are enough for the 95%
+ * confidence interval of the mean to be within epsilon of it, unless
+ * that would take more than maxsecs. prep(argp), if given, runs before
+ * each timed run; it is not timed, but counts against maxsecs.
+ */
+double ftimer_mono(ftimer_test_funct f, void *argp, ftimer_test_funct prep,
+		   double epsilon, double maxsecs, ftimer_stats_t *stats)
+{
+    struct timespec start, t0, t1;
+    cpu_set_t old, one;
+    double t, delta, mean = 0, m2 = 0, min = 0, total = 0;
+    int i, n, pinned, cpu = sched_getcpu();
+
+    /* Stay on one core, so migrations don't land in the measurements */
+    pinned = (cpu >= 0 && sched_getaffinity(0, sizeof(old), &old) == 0);
+    if (pinned) {
+	CPU_ZERO(&one);
+	CPU_SET(cpu, &one);
+	pinned = (sched_setaffinity(0, sizeof(one), &one) == 0);
+    }
+
+    for (i = 0; i < MONO_WARMUPS; i++)
+	f(argp);
+
+    /* Welford's running mean and sum of squared deviations */
+    clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+    for (n = 1; n <= MONO_MAXRUNS; n++) {
+	if (prep)
+	    prep(argp);
+	clock_gettime(CLOCK_MONOTONIC_RAW, &t0);
+	f(argp);
+	clock_gettime(CLOCK_MONOTONIC_RAW, &t1);
+	t = (t1.tv_sec - t0.tv_sec) + 1E-9*(t1.tv_nsec - t0.tv_nsec);
+	delta = t - mean;
+	mean += delta / n;
+	m2 += delta * (t - mean);
+	if (n == 1 || t < min)
+	    min = t;
+	/* prep counts against maxsecs too */
+	total = (t1.tv_sec - start.tv_sec) + 1E-9*(t1.tv_nsec - start.tv_nsec);
+
+	if (n >= MONO_MINRUNS && 
+	    (t95(n - 1) * sqrt(m2 / (n - 1) / n) <= epsilon * mean ||
+	     total >= maxsecs))
+	    break;
+    }
+    if (n > MONO_MAXRUNS)
+	n = MONO_MAXRUNS;
+
+    if (pinned)
+	sched_setaffinity(0, sizeof(old), &old);
+
+    stats->mean = mean;
+    stats->stddev = (n > 1) ? sqrt(m2 / (n - 1)) : 0;
+    stats->min = min;
+    stats->runs = n;
+    return mean;
+}
+
 
 /*
  * Routines for manipulating the Unix interval timer
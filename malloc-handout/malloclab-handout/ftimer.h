@@ -12,3 +12,16 @@ double ftimer_itimer(ftimer_test_funct f, void *argp, int n);
    Return the average of n runs */
 double ftimer_gettod(ftimer_test_funct f, void *argp, int n);
 
+/* Mean, standard deviation and minimum in seconds of a set of runs */
+typedef struct {
+    double mean, stddev, min;
+    int runs;
+} ftimer_stats_t;
+
+/* Estimate the running time of f(argp) using clock_gettime(CLOCK_MONOTONIC_RAW)
+   with the thread pinned to its core. After warmup runs, repeat until the
+   95% confidence interval of the mean is within epsilon of it, or maxsecs
+   have been spent. Unless it is NULL, prep(argp) runs untimed before each
+   timed run. Return the mean, and the spread of the runs in *stats */
+double ftimer_mono(ftimer_test_funct f, void *argp, ftimer_test_funct prep,
+		   double epsilon, double maxsecs, ftimer_stats_t *stats);
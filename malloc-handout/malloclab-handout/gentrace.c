@@ -0,0 +1,357 @@
+/*
+ * gentrace.c - generate synthetic malloc lab traces
+ *
+ *	unix> gentrace -n 1000000 -z pow:16:65536:1.5 -l exp:2000 big.rep
+ *	unix> gentrace -b -n 5000000 -z bimodal:32:4096:0.9 big.bin
+ *
+ * Objects are allocated one after another. Each gets a size from the
+ * size distribution and a lifetime, counted in later allocations, from
+ * the lifetime distribution; it is freed once that many objects have
+ * been allocated after it. Objects still live at the end are freed
+ * then, so every trace is balanced. A distribution is one of
+ *
+ *	uniform:<min>:<max>          uniform on [min, max]
+ *	pow:<min>:<max>:<alpha>      power law p(x) ~ x^-alpha on [min, max]
+ *	bimodal:<a>:<b>:<p>          a with probability p, otherwise b
+ *	exp:<mean>                   exponential with the given mean
+ *	hist:<file>                  "<value> <weight>" lines of a histogram
+ *
+ * The same seed always gives the same trace.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+
+#include "trace.h"
+
+int verbose = 0; /* read by trace.c */
+
+/* A distribution to draw sizes or lifetimes from */
+typedef struct {
+    enum {UNIFORM, POW, BIMODAL, EXP, HIST} kind;
+    double a, b, c;   /* parameters, in the order of the spec */
+    int n;            /* HIST: number of bins... */
+    double *value;    /* ... their values ... */
+    double *cum;      /* ... and cumulative weights */
+} dist_t;
+
+/* A pending free, ordered by the allocation count it happens at */
+typedef struct {
+    long when;
+    int id;
+} event_t;
+
+static uint64_t rng_state;
+
+static event_t *heap;  /* min-heap of pending frees */
+static int heap_len;
+
+static void usage(void);
+static void gen_error(char *msg);
+
+/*
+ * rnd - uniform on (0, 1), from xorshift64*
+ */
+static double rnd(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return ((rng_state * 2685821657736338717ULL >> 11) + 0.5) / 9007199254740992.0;
+}
+
+/*
+ * read_hist - read a histogram file of "<value> <weight>" lines into d
+ */
+static void read_hist(dist_t *d, char *path)
+{
+    FILE *f;
+    double value, weight, total = 0;
+    int max = 0;
+    char msg[1024];
+
+    if ((f = fopen(path, "r")) == NULL) {
+	snprintf(msg, sizeof(msg), "Could not open histogram %s", path);
+	gen_error(msg);
+    }
+    d->n = 0;
+    d->value = d->cum = NULL;
+    while (fscanf(f, "%lf %lf", &value, &weight) == 2) {
+	if (d->n == max) {
+	    max = max ? 2*max : 64;
+	    if ((d->value = realloc(d->value, max * sizeof(double))) == NULL ||
+		(d->cum = realloc(d->cum, max * sizeof(double))) == NULL)
+		gen_error("realloc failed in read_hist");
+	}
+	total += weight;
+	d->value[d->n] = value;
+	d->cum[d->n] = total;
+	d->n++;
+    }
+    fclose(f);
+    if (d->n == 0 || total <= 0) {
+	snprintf(msg, sizeof(msg), "Empty histogram %s", path);
+	gen_error(msg);
+    }
+}
+
+/*
+ * parse_dist - parse a distribution spec, exiting on a bad one
+ */
+static void parse_dist(dist_t *d, char *spec)
+{
+    char *arg = strchr(spec, ':');
+    int n = 0;
+
+    if (arg++ == NULL) {
+	fprintf(stderr, "gentrace: bad distribution %s\n", spec);
+	exit(1);
+    }
+    if (strncmp(spec, "uniform:", 8) == 0) {
+	d->kind = UNIFORM;
+	n = (sscanf(arg, "%lf:%lf", &d->a, &d->b) == 2 && d->a <= d->b);
+    }
+    else if (strncmp(spec, "pow:", 4) == 0) {
+	d->kind = POW;
+	n = (sscanf(arg, "%lf:%lf:%lf", &d->a, &d->b, &d->c) == 3
+	     && d->a > 0 && d->a <= d->b);
+    }
+    else if (strncmp(spec, "bimodal:", 8) == 0) {
+	d->kind = BIMODAL;
+	n = (sscanf(arg, "%lf:%lf:%lf", &d->a, &d->b, &d->c) == 3);
+    }
+    else if (strncmp(spec, "exp:", 4) == 0) {
+	d->kind = EXP;
+	n = (sscanf(arg, "%lf", &d->a) == 1 && d->a > 0);
+    }
+    else if (strncmp(spec, "hist:", 5) == 0) {
+	d->kind = HIST;
+	read_hist(d, arg);
+	n = 1;
+    }
+    if (!n) {
+	fprintf(stderr, "gentrace: bad distribution %s\n", spec);
+	exit(1);
+    }
+}
+
+/*
+ * sample - draw one value from d
+ */
+static double sample(dist_t *d)
+{
+    double u = rnd(), e;
+    int lo, hi, mid;
+
+    switch (d->kind) {
+    case UNIFORM:
+	return d->a + u * (d->b - d->a + 1);
+    case POW:
+	if (fabs(d->c - 1.0) < 1e-9)   /* inverse CDF of x^-alpha */
+	    return d->a * pow(d->b / d->a, u);
+	e = 1.0 - d->c;
+	return pow(pow(d->a, e) + u * (pow(d->b, e) - pow(d->a, e)), 1.0 / e);
+    case BIMODAL:
+	return (u < d->c) ? d->a : d->b;
+    case EXP:
+	return -d->a * log(u);
+    case HIST:
+	u *= d->cum[d->n - 1];
+	for (lo = 0, hi = d->n - 1; lo < hi; ) {
+	    mid = (lo + hi) / 2;
+	    if (d->cum[mid] < u)
+		lo = mid + 1;
+	    else
+		hi = mid;
+	}
+	return d->value[lo];
+    }
+    return 0;
+}
+
+/*
+ * heap_push, heap_pop - the min-heap of pending frees
+ */
+static void heap_push(long when, int id)
+{
+    int i = heap_len++, parent;
+
+    while (i > 0 && heap[parent = (i - 1) / 2].when > when) {
+	heap[i] = heap[parent];
+	i = parent;
+    }
+    heap[i].when = when;
+    heap[i].id = id;
+}
+
+static event_t heap_pop(void)
+{
+    event_t top = heap[0], last = heap[--heap_len];
+    int i = 0, child;
+
+    while ((child = 2*i + 1) < heap_len) {
+	if (child + 1 < heap_len && heap[child + 1].when < heap[child].when)
+	    child++;
+	if (heap[child].when >= last.when)
+	    break;
+	heap[i] = heap[child];
+	i = child;
+    }
+    heap[i] = last;
+    return top;
+}
+
+/*
+ * add_op - append a request to the trace
+ */
+static void add_op(trace_t *trace, int type, int index, int size)
+{
+    traceop_t *op = &trace->ops[trace->num_ops++];
+
+    op->type = type;
+    op->index = index;
+    op->size = size;
+}
+
+/*
+ * draw_size - a request size from d, at least one byte
+ */
+static int draw_size(dist_t *d)
+{
+    double size = sample(d);
+
+    if (size < 1)
+	return 1;
+    return (size > INT_MAX) ? INT_MAX : (int)size;
+}
+
+int main(int argc, char **argv)
+{
+    int c, binary = 0, id, size, last = -1;
+    long i, num_objects = 10000;
+    double realloc_frac = 0, total = 0, lifetime;
+    dist_t sizes, lifetimes;
+    char *live;
+    event_t ev;
+    trace_t trace;
+    FILE *out;
+
+    rng_state = 1;
+    parse_dist(&sizes, "pow:16:4096:1.5");
+    parse_dist(&lifetimes, "exp:1000");
+    while ((c = getopt(argc, argv, "hbn:s:z:l:r:")) != EOF) {
+	switch (c) {
+	case 'b':
+	    binary = 1;
+	    break;
+	case 'n':
+	    num_objects = atol(optarg);
+	    break;
+	case 's':
+	    rng_state = strtoull(optarg, NULL, 0) * 2 + 1;
+	    break;
+	case 'z':
+	    parse_dist(&sizes, optarg);
+	    break;
+	case 'l':
+	    parse_dist(&lifetimes, optarg);
+	    break;
+	case 'r':
+	    realloc_frac = atof(optarg);
+	    break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+    if (argc - optind != 1 || num_objects < 1 || num_objects > INT_MAX / 3) {
+	usage();
+	exit(1);
+    }
+
+    /* Every object is allocated and freed once, and maybe resized once */
+    memset(&trace, 0, sizeof(trace));
+    if ((trace.ops = malloc(3 * num_objects * sizeof(traceop_t))) == NULL ||
+	(heap = malloc(num_objects * sizeof(event_t))) == NULL ||
+	(live = calloc(num_objects, 1)) == NULL)
+	gen_error("malloc failed in main");
+
+    for (i = 0; i < num_objects; i++) {
+	/* Free whatever has come to the end of its life */
+	while (heap_len > 0 && heap[0].when <= i) {
+	    ev = heap_pop();
+	    add_op(&trace, FREE, ev.id, 0);
+	    live[ev.id] = 0;
+	}
+
+	/* Sometimes resize the previous object instead of a new one */
+	if (last >= 0 && live[last] && rnd() < realloc_frac) {
+	    size = draw_size(&sizes);
+	    add_op(&trace, REALLOC, last, size);
+	    total += size;
+	}
+
+	id = i;
+	size = draw_size(&sizes);
+	add_op(&trace, ALLOC, id, size);
+	total += size;
+	live[id] = 1;
+	last = id;
+	lifetime = sample(&lifetimes);
+	heap_push(i + 1 + (lifetime < LONG_MAX / 2 ? (long)lifetime : LONG_MAX / 2),
+		  id);
+    }
+    while (heap_len > 0) {
+	ev = heap_pop();
+	add_op(&trace, FREE, ev.id, 0);
+    }
+
+    trace.num_ids = num_objects;
+    trace.sugg_heapsize = (total + 100 > INT_MAX) ? INT_MAX : (int)total + 100;
+    trace.weight = 1;
+
+    if ((out = fopen(argv[optind], "w")) == NULL) {
+	printf("Could not open %s: %s\n", argv[optind], strerror(errno));
+	exit(1);
+    }
+    if (binary)
+	write_trace_bin(out, &trace);
+    else
+	write_trace_rep(out, &trace);
+    if (fclose(out) != 0) {
+	printf("Could not write %s: %s\n", argv[optind], strerror(errno));
+	exit(1);
+    }
+    return 0;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: gentrace [-hb] [-n <objects>] [-s <seed>] [-z <dist>] [-l <dist>]\n"
+	    "                [-r <frac>] <out>\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-b         Write a binary trace instead of text (.rep).\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-l <dist>  Lifetimes, in later allocations (default exp:1000).\n");
+    fprintf(stderr, "\t-n <n>     Number of objects to allocate (default 10000).\n");
+    fprintf(stderr, "\t-r <frac>  Resize the previous object before <frac> of allocations.\n");
+    fprintf(stderr, "\t-s <seed>  Seed for the random number generator (default 0).\n");
+    fprintf(stderr, "\t-z <dist>  Request sizes (default pow:16:4096:1.5).\n");
+    fprintf(stderr, "Distributions\n");
+    fprintf(stderr, "\tuniform:<min>:<max>, pow:<min>:<max>:<alpha>, bimodal:<a>:<b>:<p>,\n");
+    fprintf(stderr, "\texp:<mean>, hist:<file of \"value weight\" lines>\n");
+}
+
+static void gen_error(char *msg)
+{
+    printf("%s: %s\n", msg, strerror(errno));
+    exit(1);
+}
@@ -0,0 +1,68 @@
+/*
+ * hist.c - log-bucketed latency histograms
+ *
+ * Values below HIST_SUB get a bucket each. Above that, every power of
+ * two [2^k, 2^(k+1)) is split into HIST_SUB equal sub-buckets.
+ */
+#include <string.h>
+
+#include "hist.h"
+
+/* bucket_of - the bucket holding value v */
+static int bucket_of(uint64_t v)
+{
+    int k;
+
+    if (v < HIST_SUB)
+	return v;
+    k = 63 - __builtin_clzll(v);   /* v is in [2^k, 2^(k+1)) */
+    return (k - HIST_SUB_BITS + 1) * HIST_SUB
+	+ ((v >> (k - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+/* bucket_high - the largest value that falls in bucket b */
+static uint64_t bucket_high(int b)
+{
+    int k = b / HIST_SUB + HIST_SUB_BITS - 1;
+    uint64_t sub = b % HIST_SUB;
+
+    if (b < HIST_SUB)
+	return b;
+    return ((HIST_SUB + sub + 1) << (k - HIST_SUB_BITS)) - 1;
+}
+
+void hist_clear(hist_t *h)
+{
+    memset(h, 0, sizeof(*h));
+}
+
+void hist_record(hist_t *h, uint64_t v)
+{
+    h->buckets[bucket_of(v)]++;
+    h->count++;
+    if (v > h->max)
+	h->max = v;
+}
+
+/*
+ * hist_percentile - the value below which pct percent of the recorded
+ *     values lie, rounded up to its bucket's upper edge but never past
+ *     the true maximum
+ */
+uint64_t hist_percentile(hist_t *h, double pct)
+{
+    uint64_t rank, seen = 0;
+    int b;
+
+    if (h->count == 0)
+	return 0;
+    rank = (uint64_t)(pct / 100.0 * h->count + 0.5);
+    if (rank < 1)
+	rank = 1;
+    for (b = 0; b < HIST_BUCKETS; b++) {
+	seen += h->buckets[b];
+	if (seen >= rank)
+	    return bucket_high(b) < h->max ? bucket_high(b) : h->max;
+    }
+    return h->max;
+}
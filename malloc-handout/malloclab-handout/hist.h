@@ -0,0 +1,27 @@
+#ifndef __HIST_H_
+#define __HIST_H_
+
+/*
+ * hist.h - log-bucketed latency histograms
+ *
+ * Values are bucketed by their leading HIST_SUB_BITS+1 bits, in the
+ * style of HdrHistogram, so every recorded value is reported within
+ * 1/2^HIST_SUB_BITS of itself while the histogram stays a fixed size.
+ */
+#include <stdint.h>
+
+#define HIST_SUB_BITS 4
+#define HIST_SUB      (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS  ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+typedef struct {
+    uint64_t count;                 /* number of values recorded */
+    uint64_t max;                   /* largest value recorded, exactly */
+    uint64_t buckets[HIST_BUCKETS];
+} hist_t;
+
+void hist_clear(hist_t *h);
+void hist_record(hist_t *h, uint64_t v);
+uint64_t hist_percentile(hist_t *h, double pct);
+
+#endif /* __HIST_H_ */
@@ -0,0 +1,111 @@
+/*
+ * idmap.c - map from live block ids to their payloads
+ *
+ * An open-addressed hash table with linear probing, kept at most half
+ * full. Removal shifts later entries of the probe run back, so there
+ * are no tombstones and the table only ever grows with the peak number
+ * of live ids.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "idmap.h"
+
+#define IDMAP_MIN 1024  /* initial number of slots */
+
+static size_t slot_of(idmap_t *map, int id)
+{
+    return ((unsigned)id * 2654435761u) & map->mask;
+}
+
+static void idmap_alloc(idmap_t *map, size_t nslots)
+{
+    size_t i;
+
+    if ((map->slots = malloc(nslots * sizeof(idmap_entry_t))) == NULL) {
+	printf("malloc failed in idmap\n");
+	exit(1);
+    }
+    for (i = 0; i < nslots; i++)
+	map->slots[i].id = -1;
+    map->mask = nslots - 1;
+    map->live = 0;
+}
+
+void idmap_init(idmap_t *map)
+{
+    idmap_alloc(map, IDMAP_MIN);
+}
+
+void idmap_free(idmap_t *map)
+{
+    free(map->slots);
+    map->slots = NULL;
+}
+
+/*
+ * idmap_grow - double the table, rehashing every live id
+ */
+static void idmap_grow(idmap_t *map)
+{
+    idmap_entry_t *old = map->slots;
+    size_t i, n = map->mask + 1;
+
+    idmap_alloc(map, 2 * n);
+    for (i = 0; i < n; i++)
+	if (old[i].id >= 0)
+	    *idmap_insert(map, old[i].id) = old[i];
+    free(old);
+}
+
+/*
+ * idmap_insert - the entry for id, added if it is not in the map yet
+ */
+idmap_entry_t *idmap_insert(idmap_t *map, int id)
+{
+    size_t i;
+
+    if (2 * (map->live + 1) > map->mask + 1)
+	idmap_grow(map);
+    for (i = slot_of(map, id); map->slots[i].id >= 0; i = (i + 1) & map->mask)
+	if (map->slots[i].id == id)
+	    return &map->slots[i];
+    map->slots[i].id = id;
+    map->live++;
+    return &map->slots[i];
+}
+
+/*
+ * idmap_find - the entry for id, or NULL if it is not in the map
+ */
+idmap_entry_t *idmap_find(idmap_t *map, int id)
+{
+    size_t i;
+
+    for (i = slot_of(map, id); map->slots[i].id >= 0; i = (i + 1) & map->mask)
+	if (map->slots[i].id == id)
+	    return &map->slots[i];
+    return NULL;
+}
+
+/*
+ * idmap_remove - remove entry e, which idmap_find or idmap_insert gave
+ */
+void idmap_remove(idmap_t *map, idmap_entry_t *e)
+{
+    size_t hole = e - map->slots, i = hole, home;
+
+    for (;;) {
+	i = (i + 1) & map->mask;
+	if (map->slots[i].id < 0)
+	    break;
+	/* Move entry i into the hole unless its home lies after the hole */
+	home = slot_of(map, map->slots[i].id);
+	if (((i - home) & map->mask) >= ((i - hole) & map->mask)) {
+	    map->slots[hole] = map->slots[i];
+	    hole = i;
+	}
+    }
+    map->slots[hole].id = -1;
+    map->live--;
+}
@@ -0,0 +1,31 @@
+#ifndef __IDMAP_H_
+#define __IDMAP_H_
+
+/*
+ * idmap.h - map from live block ids to their payloads
+ *
+ * Used instead of the trace_t blocks/block_sizes arrays when a trace
+ * is streamed, so memory grows with the number of live blocks rather
+ * than with the number of ids in the trace.
+ */
+#include <stddef.h>
+
+typedef struct {
+    int id;        /* block id, or -1 for an empty slot */
+    char *ptr;     /* payload returned by the allocator */
+    size_t size;   /* payload size requested */
+} idmap_entry_t;
+
+typedef struct {
+    idmap_entry_t *slots;
+    size_t mask;   /* number of slots - 1, a power of two minus one */
+    size_t live;   /* number of ids in the map */
+} idmap_t;
+
+void idmap_init(idmap_t *map);
+void idmap_free(idmap_t *map);
+idmap_entry_t *idmap_insert(idmap_t *map, int id);
+idmap_entry_t *idmap_find(idmap_t *map, int id);
+void idmap_remove(idmap_t *map, idmap_entry_t *e);
+
+#endif /* __IDMAP_H_ */
@@ -7,21 +7,35 @@
  * Copyright (c) 2002, R. Bryant and D. O'Hallaron, All rights reserved.
  * May not be used, modified, or copied without permission.
  */
+#define _GNU_SOURCE  /* for RTLD_DEEPBIND and CPU_SET */
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
+#include <ctype.h>
 #include <assert.h>
 #include <float.h>
 #include <math.h>
 #include <inttypes.h>
 #include <time.h>
+#include <getopt.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <dlfcn.h>
 
 #include "mm.h"
 #include "memlib.h"
 #include "pagemap.h"
 #include "fsecs.h"
+#include "fcyc.h"
+#include "trace.h"
+#include "mtreplay.h"
+#include "hist.h"
+#include "perfctr.h"
+#include "idmap.h"
 #include "config.h"
 
 /**********************
@@ -33,6 +47,18 @@
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
 
+/* Long options, numbered past the single-character ones */
+enum { OPT_JSON = 256, OPT_CSV, OPT_BASELINE, OPT_TOLERANCE, 
+       OPT_KOPS_TOLERANCE, OPT_TIMELINE, OPT_FRAG, OPT_TOUCH, OPT_TOUCH_CHECK, OPT_RSS,
+       OPT_MIN_HEAP, OPT_COLD, OPT_PERSIST };
+
+/* How much of each payload the touching replay (--touch) writes and reads */
+enum { TOUCH_OFF, TOUCH_ALL, TOUCH_LINES, TOUCH_PREFIX };
+#define TOUCH_LINE 64  /* bytes between the words TOUCH_LINES touches */
+
+/* List nodes --persist keeps in its heap file */
+#define PERSIST_NODES 400
+
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p)  ((((uintptr_t)(p)) % ALIGNMENT) == 0)
 
@@ -40,31 +66,18 @@
  * The key compound data types 
  *****************************/
 
-/* Records the extent of each block's payload */
+/* 
+ * Records the extent of each block's payload. The records form a treap
+ * ordered by lo, so the neighbours of a new block are found in O(log n).
+ */
 typedef struct range_t {
     char *lo;              /* low payload address */
     char *hi;              /* high payload address */
-    struct range_t *next;  /* next list element */
+    struct range_t *left;  /* ranges below lo (or next in the free pool) */
+    struct range_t *right; /* ranges above lo */
+    unsigned prio;         /* heap priority, smaller nearer the root */
 } range_t;
 
-/* Characterizes a single trace operation (allocator request) */
-typedef struct {
-    enum {ALLOC, FREE, REALLOC} type; /* type of request */
-    int index;                        /* index for free() to use later */
-    int size;                         /* byte size of alloc/realloc request */
-} traceop_t;
-
-/* Holds the information for one trace file*/
-typedef struct {
-    int sugg_heapsize;   /* suggested heap size (unused) */
-    int num_ids;         /* number of alloc/realloc ids */
-    int num_ops;         /* number of distinct requests */
-    int weight;          /* weight for this trace (unused) */
-    traceop_t *ops;      /* array of requests */
-    char **blocks;       /* array of ptrs returned by malloc/realloc... */
-    size_t *block_sizes; /* ... and a corresponding array of payload sizes */
-} trace_t;
-
 /* 
  * Holds the params to the xxx_speed functions, which are timed by fcyc. 
  * This struct is necessary because fcyc accepts only a pointer array
@@ -73,20 +86,88 @@ typedef struct {
 typedef struct {
     trace_t *trace;  
     range_t *ranges;
+    perfctr_t *perf;  /* if set, count hardware events into it */
 } speed_t;
 
+/* 
+ * An allocator under test: mm.c, linked in, or a shared object loaded
+ * with -b. Loaded ones get their memory from our memlib like mm.c does.
+ */
+typedef struct {
+    char *name;
+    int (*init)(void);
+    void *(*malloc)(size_t size);
+    void (*free)(void *ptr);
+    void *(*realloc)(void *ptr, size_t size); /* NULL if not exported */
+} allocator_t;
+
+/* 
+ * A utilization timeline being written for --timeline. Each row covers
+ * "every" requests and holds the peak live and heap bytes among them.
+ */
+typedef struct {
+    FILE *out;
+    long every;           /* requests per row */
+    long ops;             /* requests in the current row so far */
+    long last;            /* number of the trace's last request */
+    size_t live, heap;    /* their peaks */
+} timeline_t;
+
+/* 
+ * Resident heap bytes over a trace, for --rss. They are sampled with
+ * mincore each time the heap has grown by 1/RSS_GROWTH since the last
+ * sample, which bounds the cost at a small multiple of the peak heap.
+ */
+#define RSS_GROWTH 32
+
+typedef struct {
+    size_t sampled_heap; /* mem_heapsize() at the last sample */
+    size_t peak;         /* most resident bytes seen */
+    long minflt;         /* minor faults before the trace */
+} rss_t;
+
+/* Where the bytes of mm.c's heap went, totalled by an mm_walk */
+typedef struct {
+    size_t chunk_bytes, chunks;    /* all chunks */
+    size_t block_bytes, usable;    /* allocated blocks, and what callers can use */
+    size_t free_bytes, free_blocks;
+    size_t free_class[64];         /* free blocks of [2^i, 2^(i+1)) bytes */
+    size_t free_class_bytes[64];
+    size_t tail_bytes;
+} heapwalk_t;
+
+/* Latencies in ns of each kind of request, indexed by traceop_t type */
+typedef hist_t latency_t[3];
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
     /* defined for both libc malloc and student malloc package (mm.c) */
     double ops;      /* number of ops (malloc/free/realloc) in the trace */
     int valid;       /* was the trace processed correctly by the allocator? */
     double secs;     /* number of secs needed to run the trace */
+    double secs_sd;  /* standard deviation of secs over the timed runs */
+    double secs_min; /* the fastest of those runs */
+    int runs;        /* how many runs were timed */
+    double touch_secs; /* secs with the payloads touched (--touch), or 0 */
+    double cold_secs;  /* secs with the caches flushed before each run (--cold), or 0 */
+
+    /* with --rss, over the util pass */
+    double rss_util; /* peak payload bytes over peak resident heap bytes */
+    size_t rss_peak; /* most resident heap bytes seen */
+    size_t rss_end;  /* resident heap bytes after the last request */
+    long minflt;     /* minor page faults */
+
+    /* with --min-heap, for mm.c */
+    size_t min_heap; /* smallest heap cap the trace completes under, or 0 */
+    double min_util; /* peak payload bytes over min_heap */
 
     /* defined only for the student malloc package */
     double util;     /* overall space utilization for this trace (always 0 for libc) */
 
     double inst_util;     /* instanteous space utilization for this trace (always 0 for libc) */
 
+    perfctr_t perf;  /* hardware event counts over the speed runs (-e) */
+
     /* Note: secs and util are only defined if valid is true */
 } stats_t; 
 
@@ -95,8 +176,22 @@ typedef struct {
  *******************/
 int verbose = 0;        /* global flag for verbose output */
 static int errors = 0;  /* number of errs found when running student malloc */
+static int perf_events = 0; /* number of hardware counters opened for -e */
+static long timeline_every = 0; /* requests per --timeline row, 0 if off */
+static int frag_report = 0;     /* print the heap at its peak (--frag) */
+static int touch_mode = TOUCH_OFF; /* payload bytes the --touch replay uses */
+static size_t touch_prefix = 0; /* with TOUCH_PREFIX, bytes per block */
+static int touch_check = 0;     /* verify touched payloads (--touch-check) */
+static int rss_report = 0;      /* sample resident memory and faults (--rss) */
+static int min_heap_report = 0; /* search for the smallest heap cap (--min-heap) */
+static int cold_cache = 0;      /* also time with cold caches (--cold) */
+static volatile uint64_t touch_sink; /* keeps unchecked reads alive */
 char msg[MAXLINE];      /* for whenever we need to compose an error message */
 
+/* The allocator being evaluated, mm.c unless a -b backend is running */
+static allocator_t mm_builtin = {"mm.c", mm_init, mm_malloc, mm_free, mm_realloc};
+static allocator_t *mm = &mm_builtin;
+
 /* Directory where default tracefiles are found */
 static char tracedir[MAXLINE] = TRACEDIR;
 
@@ -110,28 +205,73 @@ static char *default_tracefiles[] = {
  * Function prototypes 
  *********************/
 
-/* these functions manipulate range lists */
+/* these functions manipulate range trees */
 static int add_range(range_t **ranges, char *lo, int size, 
 		     int tracenum, int opnum);
 static void remove_range(range_t **ranges, char *lo);
 static void clear_ranges(range_t **ranges);
 
-/* These functions read, allocate, and free storage for traces */
-static trace_t *read_trace(char *tracedir, char *filename);
-static void free_trace(trace_t *trace);
-
 /* Routines for evaluating the correctness and speed of libc malloc */
 static int eval_libc_valid(trace_t *trace, int tracenum);
 static void eval_libc_speed(void *ptr);
 
 /* Routines for evaluating correctnes, space utilization, and speed 
    of the student's malloc package in mm.c */
+static void *mm_resize(void *ptr, int oldsize, int size);
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges, double *inst_ratio);
+static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges, 
+			   double *inst_ratio, timeline_t *tl, stats_t *rss);
 static void eval_mm_speed(void *ptr);
+static void eval_mm_latency(trace_t *trace, latency_t lat);
+static void eval_mm_touch(void *ptr);
+static void eval_mm_frag(trace_t *trace, int tracenum);
+static int replay_capped(trace_t *trace, int tracenum, size_t limit,
+			 size_t *max_heap, size_t *max_live);
+static void eval_mm_min_heap(trace_t *trace, int tracenum, stats_t *stats);
+
+/* Routines for evaluating one trace, possibly in a worker process */
+static void eval_mm_traces(int n, char **tracefiles, stats_t *stats,
+			   latency_t *lat, size_t profile_bytes, 
+			   int jobs, int serial_speed, int stream);
+static void eval_mm_trace(char *tracefile, int tracenum, stats_t *stats,
+			  latency_t lat, size_t profile_bytes, int run_speed);
+static void time_mm_trace(trace_t *trace, stats_t *stats, latency_t lat);
+static void flush_caches(void *arg);
+static void eval_mm_parallel(int n, char **tracefiles, stats_t *stats,
+			     latency_t *lat, size_t profile_bytes, 
+			     int run_speed, int jobs);
+static void pin_worker(int slot);
+
+/* Routines for evaluating a trace streamed from its file (-S) */
+static void eval_mm_stream(char *tracefile, int tracenum, stats_t *stats);
+static int stream_mm_util(char *tracefile, int tracenum, stats_t *stats);
+static double stream_mm_speed(char *tracefile);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
+static void printperf(double *count, double ops);
+static void printlatency(int n, stats_t *stats, latency_t *lat);
+static void printbackends(int n, int num_allocs, allocator_t *allocs,
+			  stats_t **stats);
+static void load_backend(allocator_t *a, char *path);
+static void write_json(char *path, int n, char **tracefiles, stats_t *stats,
+		       double perfindex);
+static void write_csv(char *path, int n, char **tracefiles, stats_t *stats,
+		      double perfindex);
+static int check_baseline(char *path, double tolerance, double kops_tolerance,
+			  int n, char **tracefiles, stats_t *stats);
+static void write_profile(char *tracefile);
+static timeline_t *timeline_open(char *tracefile, long num_ops);
+static void timeline_record(timeline_t *tl, long opnum, size_t live, 
+			    size_t heap);
+static void timeline_close(timeline_t *tl);
+static void rss_start(rss_t *r);
+static void rss_touch(char *p, int size);
+static void rss_sample(rss_t *r, size_t heap_size);
+static void rss_finish(rss_t *r, size_t max_total_size, stats_t *stats);
+static void mt_results(trace_t *trace, char *tracefile, int nthreads,
+		       double remote_frac);
+static int check_persist(char *path);
 static void usage(void);
 static void unix_error(char *msg);
 static void malloc_error(int tracenum, int opnum, char *msg);
@@ -143,17 +283,52 @@ static void app_error(char *msg);
 int main(int argc, char **argv)
 {
     int i;
-    char c;
+    int c;
     char **tracefiles = NULL;  /* null-terminated array of trace file names */
     int num_tracefiles = 0;    /* the number of traces in that array */
     trace_t *trace = NULL;     /* stores a single trace file in memory */
-    range_t *ranges = NULL;    /* keeps track of block extents for one trace */
     stats_t *libc_stats = NULL;/* libc stats for each trace */
     stats_t *mm_stats = NULL;  /* mm (i.e. student) stats for each trace */
     speed_t speed_params;      /* input parameters to the xx_speed routines */ 
 
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    size_t profile_bytes = 0; /* If set, heap profile sampling rate (-p) */
+    int mt_threads = 0;  /* If set, max threads for the replay (-T) */
+    int run_latency = 0; /* If set, time each mm request (set by -L) */
+    int run_perf = 0;    /* If set, count hardware events (set by -e) */
+    latency_t *mm_lat = NULL;  /* mm per-request latencies for each trace */
+    double remote_frac = 0; /* Fraction of frees passed to another thread (-r) */
+    int jobs = 0;        /* If set, evaluate this many traces at once (-j) */
+    int serial_speed = 0;/* If set, time the traces one at a time after -j (-s) */
+    int stream = 0;      /* If set, stream the traces from their files (-S) */
+    allocator_t *allocs = NULL; /* mm.c, then the backends loaded with -b */
+    int num_allocs = 1;
+    stats_t **alloc_stats = NULL; /* stats for each trace, per allocator */
+    int mm_errors, k;
+    char *json_file = NULL;  /* If set, write the results as JSON (--json) */
+    char *csv_file = NULL;   /* If set, write the results as CSV (--csv) */
+    char *baseline = NULL;   /* If set, CSV results to compare with (--baseline) */
+    double tolerance = 5;    /* Percent util may fall below its baseline */
+    double kops_tolerance = 20; /* ... and Kops, which is noisier */
+    int regressions = 0;
+    char *persist_file = NULL; /* If set, check a heap file instead (--persist) */
+    static struct option long_options[] = {
+	{"json", required_argument, NULL, OPT_JSON},
+	{"csv", required_argument, NULL, OPT_CSV},
+	{"baseline", required_argument, NULL, OPT_BASELINE},
+	{"tolerance", required_argument, NULL, OPT_TOLERANCE},
+	{"kops-tolerance", required_argument, NULL, OPT_KOPS_TOLERANCE},
+	{"timeline", optional_argument, NULL, OPT_TIMELINE},
+	{"frag", no_argument, NULL, OPT_FRAG},
+	{"touch", optional_argument, NULL, OPT_TOUCH},
+	{"touch-check", no_argument, NULL, OPT_TOUCH_CHECK},
+	{"rss", no_argument, NULL, OPT_RSS},
+	{"min-heap", no_argument, NULL, OPT_MIN_HEAP},
+	{"cold", no_argument, NULL, OPT_COLD},
+	{"persist", required_argument, NULL, OPT_PERSIST},
+	{NULL, 0, NULL, 0}
+    };
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, inst_util, avg_mm_inst_util, avg_mm_util, avg_mm_throughput;
@@ -163,7 +338,8 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt_long(argc, argv, "f:t:b:hvVgaelLp:T:r:j:sS", 
+			    long_options, NULL)) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
@@ -183,15 +359,106 @@ int main(int argc, char **argv)
 	    if (tracedir[strlen(tracedir)-1] != '/') 
 		strcat(tracedir, "/"); /* path always ends with "/" */
 	    break;
+        case 'b': /* Load another allocator to compare against mm.c */
+            if ((allocs = realloc(allocs, (num_allocs+1)*sizeof(allocator_t))) == NULL)
+		unix_error("ERROR: realloc failed in main");
+	    load_backend(&allocs[num_allocs++], optarg);
+            break;
+        case 'e': /* Count hardware events in the speed runs */
+            run_perf = 1;
+            break;
+        case 'j': /* Evaluate traces in this many worker processes */
+            jobs = atoi(optarg);
+            if (jobs < 2) {
+		fprintf(stderr, "-j needs at least 2 workers\n");
+		usage();
+		exit(1);
+            }
+            break;
+        case 's': /* With -j, time the traces serially afterwards */
+            serial_speed = 1;
+            break;
+        case 'S': /* Stream traces instead of reading them into memory */
+            stream = 1;
+            break;
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
+        case 'L': /* Time every request in a separate pass */
+            run_latency = 1;
+            break;
+        case 'p': /* Sample a heap profile during the util pass */
+            profile_bytes = strtoul(optarg, NULL, 0);
+            break;
+        case 'T': /* Replay on up to this many threads at once */
+            mt_threads = atoi(optarg);
+            break;
+        case 'r': /* Fraction of frees made by a different thread */
+            remote_frac = atof(optarg);
+            if (remote_frac < 0 || remote_frac > 1) {
+		fprintf(stderr, "-r takes a fraction from 0 to 1\n");
+		usage();
+		exit(1);
+            }
+            break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
         case 'V': /* Be more verbose than -v */
             verbose = 2;
             break;
+        case OPT_JSON: /* Write the results as JSON */
+            json_file = optarg;
+            break;
+        case OPT_CSV: /* Write the results as CSV */
+            csv_file = optarg;
+            break;
+        case OPT_BASELINE: /* Fail on regressions against these results */
+            baseline = optarg;
+            break;
+        case OPT_TOLERANCE: /* Percent allowed below the baseline */
+            tolerance = atof(optarg);
+            break;
+        case OPT_KOPS_TOLERANCE: /* The same for Kops */
+            kops_tolerance = atof(optarg);
+            break;
+        case OPT_TIMELINE: /* Write a utilization timeline per trace */
+            timeline_every = optarg ? atol(optarg) : 1;
+            if (timeline_every < 1)
+		timeline_every = 1;
+            break;
+        case OPT_FRAG: /* Break down the heap at its peak */
+            frag_report = 1;
+            break;
+        case OPT_TOUCH: /* Also time a replay that touches the payloads */
+            if (optarg == NULL || strcmp(optarg, "all") == 0)
+		touch_mode = TOUCH_ALL;
+            else if (strcmp(optarg, "lines") == 0)
+		touch_mode = TOUCH_LINES;
+            else if ((touch_prefix = strtoul(optarg, NULL, 0)) > 0)
+		touch_mode = TOUCH_PREFIX;
+            else {
+		usage();
+		exit(1);
+            }
+            break;
+        case OPT_RSS: /* Sample resident memory and page faults */
+            rss_report = 1;
+            break;
+        case OPT_MIN_HEAP: /* Find the smallest heap each trace fits in */
+            min_heap_report = 1;
+            break;
+        case OPT_COLD: /* Also time each trace with the caches flushed */
+            cold_cache = 1;
+            break;
+        case OPT_PERSIST: /* Check mm.c's file-backed heap and exit */
+            persist_file = optarg;
+            break;
+        case OPT_TOUCH_CHECK: /* Verify what the touching replay reads */
+            touch_check = 1;
+            if (touch_mode == TOUCH_OFF)
+		touch_mode = TOUCH_ALL;
+            break;
         case 'h': /* Print this message */
 	    usage();
             exit(0);
@@ -201,6 +468,36 @@ int main(int argc, char **argv)
         }
     }
 	
+    /* A streamed trace gets a checked util pass and one timed run only */
+    if (stream && (run_perf || run_latency || profile_bytes || jobs > 1 ||
+		   touch_mode != TOUCH_OFF || cold_cache || frag_report ||
+		   min_heap_report)) {
+	fprintf(stderr, "-S cannot be combined with -e, -j, -L, -p, --touch, "
+		"--cold, --frag or --min-heap\n");
+	usage();
+	exit(1);
+    }
+
+    /* -s only changes how -j times the traces */
+    if (serial_speed && jobs == 0) {
+	fprintf(stderr, "-s needs -j\n");
+	usage();
+	exit(1);
+    }
+
+    /* -r only changes the multithreaded replay */
+    if (remote_frac != 0 && mt_threads <= 0) {
+	fprintf(stderr, "-r needs -T\n");
+	usage();
+	exit(1);
+    }
+
+    /* --persist runs its own check instead of the traces */
+    if (persist_file) {
+	mem_init();
+	exit(check_persist(persist_file));
+    }
+
     /* 
      * If no -f command line arg, then use the entire set of tracefiles 
      * defined in default_traces[]
@@ -214,6 +511,19 @@ int main(int argc, char **argv)
     /* Initialize the timing package */
     init_fsecs();
 
+    /* Twice the last-level cache, so that replacement policy can't save lines */
+    if (cold_cache) {
+	set_fcyc_cache_size(2 * fcyc_llc_bytes());
+	if (verbose)
+	    printf("Flushing %d KB of cache before each cold run.\n", 
+		   fcyc_llc_bytes() / 1024);
+    }
+
+    /* Open the hardware counters, if the system lets us */
+    if (run_perf && (perf_events = perfctr_open()) == 0)
+	printf("Hardware counters unavailable (%s), ignoring -e\n", 
+	       strerror(errno));
+
     /*
      * Optionally run and evaluate the libc malloc package 
      */
@@ -235,9 +545,16 @@ int main(int argc, char **argv)
 	    libc_stats[i].valid = eval_libc_valid(trace, i);
 	    if (libc_stats[i].valid) {
 		speed_params.trace = trace;
+		speed_params.perf = perf_events ? &libc_stats[i].perf : NULL;
 		if (verbose > 1)
 		    printf("and performance.\n");
+		if (perf_events)
+		    perfctr_start();
 		libc_stats[i].secs = fsecs(eval_libc_speed, &speed_params);
+		if (perf_events)
+		    perfctr_stop(&libc_stats[i].perf);
+		fsecs_spread(&libc_stats[i].secs_sd, &libc_stats[i].secs_min, 
+			     &libc_stats[i].runs);
 	    }
 	    free_trace(trace);
 	}
@@ -259,29 +576,16 @@ int main(int argc, char **argv)
     mm_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
     if (mm_stats == NULL)
 	unix_error("mm_stats calloc in main failed");
+    if (run_latency &&
+	(mm_lat = (latency_t *)calloc(num_tracefiles, sizeof(latency_t))) == NULL)
+	unix_error("mm_lat calloc in main failed");
     
     /* Initialize the simulated memory system in memlib.c */
     mem_init(); 
 
     /* Evaluate student's mm malloc package using the K-best scheme */
-    for (i=0; i < num_tracefiles; i++) {
-	trace = read_trace(tracedir, tracefiles[i]);
-	mm_stats[i].ops = trace->num_ops;
-	if (verbose > 1)
-	    printf("Checking mm_malloc for correctness, ");
-	mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
-	if (mm_stats[i].valid) {
-	    if (verbose > 1)
-		printf("efficiency, ");
-	    mm_stats[i].util = eval_mm_util(trace, i, &ranges, &mm_stats[i].inst_util);
-	    speed_params.trace = trace;
-	    speed_params.ranges = ranges;
-	    if (verbose > 1)
-		printf("and performance.\n");
-	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
-	}
-	free_trace(trace);
-    }
+    eval_mm_traces(num_tracefiles, tracefiles, mm_stats, mm_lat,
+		   profile_bytes, jobs, serial_speed, stream);
 
     /* Display the mm results in a compact table */
     if (verbose) {
@@ -289,6 +593,55 @@ int main(int argc, char **argv)
 	printresults(num_tracefiles, mm_stats);
 	printf("\n");
     }
+    if (run_latency) {
+	printlatency(num_tracefiles, mm_stats, mm_lat);
+	printf("\n");
+    }
+
+    /*
+     * Optionally run the same traces against each allocator loaded
+     * with -b. Their errors are reported but leave the index of mm.c alone.
+     */
+    if (num_allocs > 1) {
+	allocs[0] = mm_builtin;
+	if ((alloc_stats = calloc(num_allocs, sizeof(stats_t *))) == NULL)
+	    unix_error("alloc_stats calloc in main failed");
+	alloc_stats[0] = mm_stats;
+	mm_errors = errors;
+	for (k = 1; k < num_allocs; k++) {
+	    mm = &allocs[k];
+	    errors = 0;
+	    if (verbose > 1)
+		printf("\nTesting %s\n", mm->name);
+	    if ((alloc_stats[k] = calloc(num_tracefiles, sizeof(stats_t))) == NULL)
+		unix_error("alloc_stats calloc in main failed");
+	    eval_mm_traces(num_tracefiles, tracefiles, alloc_stats[k], NULL,
+			   0, jobs, serial_speed, stream);
+	    if (verbose) {
+		printf("\nResults for %s:\n", mm->name);
+		printresults(num_tracefiles, alloc_stats[k]);
+		printf("\n");
+	    }
+	}
+	mm = &mm_builtin;
+	errors = mm_errors;
+	printbackends(num_tracefiles, num_allocs, allocs, alloc_stats);
+	printf("\n");
+    }
+
+    /*
+     * Optionally measure how mm and libc malloc scale with threads
+     */
+    if (mt_threads > 0) {
+	for (i=0; i < num_tracefiles; i++) {
+	    if (!mm_stats[i].valid)
+		continue;
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    mt_results(trace, tracefiles[i], mt_threads, remote_frac);
+	    free_trace(trace);
+	}
+	printf("\n");
+    }
 
     /* 
      * Accumulate the aggregate statistics for the student's mm package 
@@ -343,27 +696,104 @@ int main(int argc, char **argv)
 	printf("perfidx:%.0f\n", perfindex);
     }
 
-    exit(0);
+    /* 
+     * Optionally write the results for scripts and compare them with
+     * an earlier run, failing if any trace got worse
+     */
+    if (json_file)
+	write_json(json_file, num_tracefiles, tracefiles, mm_stats, perfindex);
+    if (csv_file)
+	write_csv(csv_file, num_tracefiles, tracefiles, mm_stats, perfindex);
+    if (baseline) {
+	regressions = check_baseline(baseline, tolerance, kops_tolerance,
+				     num_tracefiles, tracefiles, mm_stats);
+	if (regressions > 0)
+	    printf("%d regressions against %s\n", regressions, baseline);
+    }
+
+    exit(regressions > 0 ? 2 : 0);
 }
 
 
 /*****************************************************************
- * The following routines manipulate the range list, which keeps 
+ * The following routines manipulate the range tree, which keeps 
  * track of the extent of every allocated block payload. We use the 
- * range list to detect any overlapping allocated blocks.
+ * range tree to detect any overlapping allocated blocks.
  ****************************************************************/
 
+#define RANGE_SLAB 4096  /* range records allocated at a time */
+
+static range_t *range_pool = NULL; /* unused range records */
+
+/*
+ * range_alloc - take a record from the pool, refilling it a slab at a
+ *     time; records are never returned to libc
+ */
+static range_t *range_alloc(void)
+{
+    static unsigned seed = 2463534242u;
+    range_t *p;
+    int i;
+
+    if (range_pool == NULL) {
+	if ((p = (range_t *)malloc(RANGE_SLAB * sizeof(range_t))) == NULL)
+	    unix_error("malloc error in add_range");
+	for (i = 0; i < RANGE_SLAB; i++) {
+	    p[i].left = range_pool;
+	    range_pool = &p[i];
+	}
+    }
+    p = range_pool;
+    range_pool = p->left;
+
+    /* xorshift32 priorities keep the treap balanced in expectation */
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    p->prio = seed;
+    p->left = p->right = NULL;
+    return p;
+}
+
+/*
+ * range_insert - add record r to the treap rooted at *root
+ */
+static void range_insert(range_t **root, range_t *r)
+{
+    range_t *p = *root;
+
+    if (p == NULL) {
+	*root = r;
+	return;
+    }
+    if (r->lo < p->lo) {
+	range_insert(&p->left, r);
+	if (p->left->prio < p->prio) {     /* rotate right */
+	    *root = p->left;
+	    p->left = (*root)->right;
+	    (*root)->right = p;
+	}
+    } else {
+	range_insert(&p->right, r);
+	if (p->right->prio < p->prio) {    /* rotate left */
+	    *root = p->right;
+	    p->right = (*root)->left;
+	    (*root)->left = p;
+	}
+    }
+}
+
 /*
  * add_range - As directed by request opnum in trace tracenum,
  *     we've just called the student's mm_malloc to allocate a block of 
  *     size bytes at addr lo. After checking the block for correctness,
- *     we create a range struct for this block and add it to the range list. 
+ *     we create a range struct for this block and add it to the range tree. 
  */
 static int add_range(range_t **ranges, char *lo, int size, 
 		     int tracenum, int opnum)
 {
     char *hi = lo + size - 1;
-    range_t *p;
+    range_t *p, *pred, *succ;
     char msg[MAXLINE];
     size_t page_size = mem_pagesize(), i;
 
@@ -393,27 +823,40 @@ static int add_range(range_t **ranges, char *lo, int size,
       return 0;
     }
 
-    /* The payload must not overlap any other payloads */
-    for (p = *ranges;  p != NULL;  p = p->next) {
-        if ((lo >= p->lo && lo <= p-> hi) ||
-            (hi >= p->lo && hi <= p->hi)) {
-	    sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
-		    lo, hi, p->lo, p->hi);
-	    malloc_error(tracenum, opnum, msg);
-	    return 0;
-        }
+    /* 
+     * The payload must not overlap any other payloads. The payloads in
+     * the tree are disjoint, so only the last one starting at or below
+     * lo and the first one starting above it can overlap.
+     */
+    pred = succ = NULL;
+    for (p = *ranges;  p != NULL; ) {
+	if (p->lo <= lo) {
+	    pred = p;
+	    p = p->right;
+	} else {
+	    succ = p;
+	    p = p->left;
+	}
+    }
+    if (pred != NULL && pred->hi >= lo)
+	p = pred;
+    else if (succ != NULL && succ->lo <= hi)
+	p = succ;
+    if (p != NULL) {
+	sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
+		lo, hi, p->lo, p->hi);
+	malloc_error(tracenum, opnum, msg);
+	return 0;
     }
 
     /* 
      * Everything looks OK, so remember the extent of this block 
-     * by creating a range struct and adding it the range list.
+     * by creating a range struct and adding it the range tree.
      */
-    if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
-	unix_error("malloc error in add_range");
-    p->next = *ranges;
+    p = range_alloc();
     p->lo = lo;
     p->hi = hi;
-    *ranges = p;
+    range_insert(ranges, p);
     return 1;
 }
 
@@ -422,159 +865,91 @@ static int add_range(range_t **ranges, char *lo, int size,
  */
 static void remove_range(range_t **ranges, char *lo)
 {
+    range_t **pp = ranges;
     range_t *p;
-    range_t **prevpp = ranges;
 
-    for (p = *ranges;  p != NULL; p = p->next) {
-        if (p->lo == lo) {
-	    *prevpp = p->next;
-            free(p);
-            break;
-        }
-        prevpp = &(p->next);
+    while ((p = *pp) != NULL && p->lo != lo)
+	pp = (lo < p->lo) ? &p->left : &p->right;
+    if (p == NULL)
+	return;
+
+    /* Rotate p down until it has at most one child, then splice it out */
+    while (p->left != NULL && p->right != NULL) {
+	if (p->left->prio < p->right->prio) {
+	    *pp = p->left;
+	    p->left = (*pp)->right;
+	    (*pp)->right = p;
+	    pp = &(*pp)->right;
+	} else {
+	    *pp = p->right;
+	    p->right = (*pp)->left;
+	    (*pp)->left = p;
+	    pp = &(*pp)->left;
+	}
     }
+    *pp = (p->left != NULL) ? p->left : p->right;
+
+    p->left = range_pool;
+    range_pool = p;
 }
 
 /*
- * clear_ranges - free all of the range records for a trace 
+ * clear_ranges - return all of the range records for a trace to the pool
  */
 static void clear_ranges(range_t **ranges)
 {
-    range_t *p;
-    range_t *pnext;
-
-    for (p = *ranges;  p != NULL;  p = pnext) {
-        pnext = p->next;
-        free(p);
-    }
+    range_t *p = *ranges;
+
+    if (p == NULL)
+	return;
+    clear_ranges(&p->left);
+    clear_ranges(&p->right);
+    p->left = range_pool;
+    range_pool = p;
     *ranges = NULL;
 }
 
 
-/**********************************************
- * The following routines manipulate tracefiles
- *********************************************/
+/**********************************************************************
+ * The following functions evaluate the correctness, space utilization,
+ * and throughput of the libc and mm malloc packages.
+ **********************************************************************/
 
 /*
- * read_trace - read a trace file and store it in memory
+ * mm_resize - Resize a block of oldsize bytes with the allocator's
+ *     realloc, or by malloc, copy and free if it exports none
  */
-static trace_t *read_trace(char *tracedir, char *filename)
+static void *mm_resize(void *ptr, int oldsize, int size)
 {
-    FILE *tracefile;
-    trace_t *trace;
-    char type[MAXLINE];
-    char path[MAXLINE];
-    unsigned index, size;
-    unsigned max_index = 0;
-    unsigned op_index;
-
-    if (verbose > 1)
-	printf("Reading tracefile: %s\n", filename);
+    void *p;
 
-    /* Allocate the trace record */
-    if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
-	unix_error("malloc 1 failed in read_trance");
-	
-    /* Read the trace file header */
-    strcpy(path, tracedir);
-    strcat(path, filename);
-    if ((tracefile = fopen(path, "r")) == NULL) {
-	sprintf(msg, "Could not open %s in read_trace", path);
-	unix_error(msg);
-    }
-    fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
-    fscanf(tracefile, "%d", &(trace->num_ids));     
-    fscanf(tracefile, "%d", &(trace->num_ops));     
-    fscanf(tracefile, "%d", &(trace->weight));        /* not used */
-    
-    /* We'll store each request line in the trace in this array */
-    if ((trace->ops = 
-	 (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
-	unix_error("malloc 2 failed in read_trace");
-
-    /* We'll keep an array of pointers to the allocated blocks here... */
-    if ((trace->blocks = 
-	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
-	unix_error("malloc 3 failed in read_trace");
-
-    /* ... along with the corresponding byte sizes of each block */
-    if ((trace->block_sizes = 
-	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
-	unix_error("malloc 4 failed in read_trace");
-    
-    /* read every request line in the trace file */
-    index = 0;
-    op_index = 0;
-    while (fscanf(tracefile, "%s", type) != EOF) {
-	switch(type[0]) {
-	case 'a':
-	    fscanf(tracefile, "%u %u", &index, &size);
-	    trace->ops[op_index].type = ALLOC;
-	    trace->ops[op_index].index = index;
-	    trace->ops[op_index].size = size;
-	    max_index = (index > max_index) ? index : max_index;
-	    break;
-	case 'r':
-	    fscanf(tracefile, "%u %u", &index, &size);
-	    trace->ops[op_index].type = REALLOC;
-	    trace->ops[op_index].index = index;
-	    trace->ops[op_index].size = size;
-	    max_index = (index > max_index) ? index : max_index;
-	    break;
-	case 'f':
-	    fscanf(tracefile, "%ud", &index);
-	    trace->ops[op_index].type = FREE;
-	    trace->ops[op_index].index = index;
-	    break;
-	default:
-	    printf("Bogus type character (%c) in tracefile %s\n", 
-		   type[0], path);
-	    exit(1);
-	}
-	op_index++;
-	
+    if (mm->realloc != NULL)
+	return mm->realloc(ptr, size);
+    if ((p = mm->malloc(size)) != NULL) {
+	memcpy(p, ptr, (oldsize < size) ? oldsize : size);
+	mm->free(ptr);
     }
-    fclose(tracefile);
-    assert(max_index == trace->num_ids - 1);
-    assert(trace->num_ops == op_index);
-    
-    return trace;
-}
-
-/*
- * free_trace - Free the trace record and the three arrays it points
- *              to, all of which were allocated in read_trace().
- */
-void free_trace(trace_t *trace)
-{
-    free(trace->ops);         /* free the three arrays... */
-    free(trace->blocks);      
-    free(trace->block_sizes);
-    free(trace);              /* and the trace record itself... */
+    return p;
 }
 
-/**********************************************************************
- * The following functions evaluate the correctness, space utilization,
- * and throughput of the libc and mm malloc packages.
- **********************************************************************/
-
 /*
  * eval_mm_valid - Check the mm malloc package for correctness
  */
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges) 
 {
-    int i;
+    int i, j;
     int index;
     int size;
+    int oldsize;
     char *newp;
     char *oldp;
     char *p;
     
-    /* Reset the heap and free any records in the range list */
+    /* Reset the heap and free any records in the range tree */
     clear_ranges(ranges);
 
     /* Call the mm package's init function */
-    if (mm_init() < 0) {
+    if (mm->init() < 0) {
 	malloc_error(tracenum, 0, "mm_init failed.");
 	return 0;
     }
@@ -589,23 +964,22 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
         case ALLOC: /* mm_malloc */
 
 	    /* Call the student's malloc */
-	    if ((p = mm_malloc(size)) == NULL) {
+	    if ((p = mm->malloc(size)) == NULL) {
 		malloc_error(tracenum, i, "mm_malloc failed.");
 		return 0;
 	    }
 	    
 	    /* 
 	     * Test the range of the new block for correctness and add it 
-	     * to the range list if OK. The block must be  be aligned properly,
+	     * to the range tree if OK. The block must be  be aligned properly,
 	     * and must not overlap any currently allocated block. 
 	     */ 
 	    if (add_range(ranges, p, size, tracenum, i) == 0)
 		return 0;
 	    
-	    /* ADDED: cgw
-	     * fill range with low byte of index.  This will be used later
-	     * if we realloc the block and wish to make sure that the old
-	     * data was copied to the new block
+	    /* 
+	     * Fill the block with the low byte of its index, so that a
+	     * later realloc can check the old data was copied over.
 	     */
 	    memset(p, index & 0xFF, size);
 
@@ -614,26 +988,38 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    trace->block_sizes[index] = size;
 	    break;
 
-        case REALLOC: /* mm_malloc + mm_free */
+        case REALLOC: /* mm_realloc */
 	    
 	    /* Call the student's realloc */
 	    oldp = trace->blocks[index];
-	    if ((newp = mm_malloc(size)) == NULL) {
-		malloc_error(tracenum, i, "mm_malloc failed.");
+	    if ((newp = mm_resize(oldp, trace->block_sizes[index], size)) == NULL) {
+		malloc_error(tracenum, i, "mm_realloc failed.");
 		return 0;
 	    }
 
-	    /* Remove the old region from the range list */
+	    /* Remove the old region from the range tree */
 	    remove_range(ranges, oldp);
 	    
-	    /* Check new block for correctness and add it to range list */
+	    /* Check new block for correctness and add it to range tree */
 	    if (add_range(ranges, newp, size, tracenum, i) == 0)
 		return 0;
 
+	    /* 
+	     * Check the new block holds the data from the old one, then
+	     * fill it with the low byte of the index again.
+	     */
+	    oldsize = trace->block_sizes[index];
+	    if (size < oldsize)
+		oldsize = size;
+	    for (j = 0; j < oldsize; j++) {
+		if ((unsigned char)newp[j] != (index & 0xFF)) {
+		    malloc_error(tracenum, i, "mm_realloc did not preserve the "
+				 "data from old block");
+		    return 0;
+		}
+	    }
 	    memset(newp, index & 0xFF, size);
 
-            mm_free(oldp);
-
 	    /* Remember region */
 	    trace->blocks[index] = newp;
 	    trace->block_sizes[index] = size;
@@ -644,7 +1030,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    /* Remove region from list and call student's free function */
 	    p = trace->blocks[index];
 	    remove_range(ranges, p);
-	    mm_free(p);
+	    mm->free(p);
 	    break;
 
 	default:
@@ -670,7 +1056,8 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  *   is always the high water mark of the heap. 
  *   
  */
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges, double *inst_ratio)
+static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges, 
+			   double *inst_ratio, timeline_t *tl, stats_t *rss)
 {   
     int i;
     int index;
@@ -681,9 +1068,12 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges, doubl
     int ratio_exp;
     char *p;
     char *newp, *oldp;
+    rss_t r = {0};
 
     /* initialize the heap and the mm malloc package */
-    if (mm_init() < 0)
+    if (rss)
+        rss_start(&r);
+    if (mm->init() < 0)
 	app_error("mm_init failed in eval_mm_util");
 
     for (i = 0;  i < trace->num_ops;  i++) {
@@ -693,8 +1083,10 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges, doubl
 	    index = trace->ops[i].index;
 	    size = trace->ops[i].size;
 
-	    if ((p = mm_malloc(size)) == NULL) 
+	    if ((p = mm->malloc(size)) == NULL) 
 		app_error("mm_malloc failed in eval_mm_util");
+	    if (rss)
+		rss_touch(p, size);
 	    
 	    /* Remember region and size */
 	    trace->blocks[index] = p;
@@ -706,16 +1098,16 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges, doubl
 
             break;
 
-	case REALLOC: /* mm_mealloc + mm_free */
+	case REALLOC: /* mm_realloc */
 	    index = trace->ops[i].index;
 	    newsize = trace->ops[i].size;
 	    oldsize = trace->block_sizes[index];
 
 	    oldp = trace->blocks[index];
-	    if ((newp = mm_malloc(newsize)) == NULL)
+	    if ((newp = mm_resize(oldp, oldsize, newsize)) == NULL)
 		app_error("mm_realloc failed in eval_mm_util");
-
-            mm_free(oldp);
+	    if (rss)
+		rss_touch(newp, newsize);
 
 	    /* Remember region and size */
 	    trace->blocks[index] = newp;
@@ -732,7 +1124,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges, doubl
 	    size = trace->block_sizes[index];
 	    p = trace->blocks[index];
 	    
-	    mm_free(p);
+	    mm->free(p);
 	    
 	    /* Keep track of current total size
 	     * of all allocated blocks */
@@ -765,9 +1157,14 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges, doubl
         accum_ratio_frac = frexp(accum_ratio_frac, &ratio_exp);
         accum_ratio_exp += ratio_exp;
         
-        // printf("%ld %ld %f\n", total_size, heap_size, ratio);
+        if (tl)
+            timeline_record(tl, i, total_size, heap_size);
+        if (rss)
+            rss_sample(&r, heap_size);
     }
 
+    if (rss)
+        rss_finish(&r, max_total_size, rss);
     mem_reset();
 
     ratio = accum_ratio_frac * pow(2, accum_ratio_exp / trace->num_ops);
@@ -789,10 +1186,13 @@ static void eval_mm_speed(void *ptr)
     int i, index, size, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
+    perfctr_t *perf = ((speed_t *)ptr)->perf;
 
     /* Reset the heap and initialize the mm package */
-    if (mm_init() < 0) 
+    if (mm->init() < 0) 
 	app_error("mm_init failed in eval_mm_speed");
+    if (perf)
+	perf->runs++;
 
     /* Interpret each trace request */
     for (i = 0;  i < trace->num_ops;  i++)
@@ -801,25 +1201,26 @@ static void eval_mm_speed(void *ptr)
         case ALLOC: /* mm_malloc */
             index = trace->ops[i].index;
             size = trace->ops[i].size;
-            if ((p = mm_malloc(size)) == NULL)
+            if ((p = mm->malloc(size)) == NULL)
 		app_error("mm_malloc error in eval_mm_speed");
             trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
             break;
 
-	case REALLOC: /* mm_malloc + mm_free */
+	case REALLOC: /* mm_realloc */
 	    index = trace->ops[i].index;
             newsize = trace->ops[i].size;
 	    oldp = trace->blocks[index];
-            if ((newp = mm_malloc(newsize)) == NULL)
+            if ((newp = mm_resize(oldp, trace->block_sizes[index], newsize)) == NULL)
 		app_error("mm_realloc error in eval_mm_speed");
-            mm_free(oldp);
             trace->blocks[index] = newp;
+            trace->block_sizes[index] = newsize;
             break;
 
         case FREE: /* mm_free */
             index = trace->ops[i].index;
             block = trace->blocks[index];
-            mm_free(block);
+            mm->free(block);
             break;
 
 	default:
@@ -830,113 +1231,533 @@ static void eval_mm_speed(void *ptr)
 }
 
 /*
- * eval_libc_valid - We run this function to make sure that the
- *    libc malloc can run to completion on the set of traces.
- *    We'll be conservative and terminate if any libc malloc call fails.
- *
+ * eval_mm_latency - replay the trace once more, timing every request 
+ *     with clock_gettime into a histogram for its type
  */
-static int eval_libc_valid(trace_t *trace, int tracenum)
+static void eval_mm_latency(trace_t *trace, latency_t lat)
 {
-    int i, newsize;
-    char *p, *newp, *oldp;
+    int i, index;
+    char *p;
+    struct timespec t0, t1;
+
+    for (i = 0; i < 3; i++)
+	hist_clear(&lat[i]);
+    if (mm->init() < 0) 
+	app_error("mm_init failed in eval_mm_latency");
 
     for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
         switch (trace->ops[i].type) {
-
-        case ALLOC: /* malloc */
-	    if ((p = malloc(trace->ops[i].size)) == NULL) {
-		malloc_error(tracenum, i, "libc malloc failed");
-		unix_error("System message");
-	    }
-	    trace->blocks[trace->ops[i].index] = p;
+        case ALLOC:
+	    p = mm->malloc(trace->ops[i].size);
 	    break;
-
-	case REALLOC: /* realloc */
-            newsize = trace->ops[i].size;
-	    oldp = trace->blocks[trace->ops[i].index];
-	    if ((newp = realloc(oldp, newsize)) == NULL) {
-		malloc_error(tracenum, i, "libc realloc failed");
-		unix_error("System message");
-	    }
-	    trace->blocks[trace->ops[i].index] = newp;
+	case REALLOC:
+	    p = mm_resize(trace->blocks[index], trace->block_sizes[index],
+			  trace->ops[i].size);
 	    break;
-	    
-        case FREE: /* free */
-	    free(trace->blocks[trace->ops[i].index]);
+        case FREE:
+	    mm->free(trace->blocks[index]);
+	    p = NULL;
 	    break;
-
 	default:
-	    app_error("invalid operation type  in eval_libc_valid");
+	    app_error("Nonexistent request type in eval_mm_latency");
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	hist_record(&lat[trace->ops[i].type], 
+		    (t1.tv_sec - t0.tv_sec) * 1000000000LL 
+		    + (t1.tv_nsec - t0.tv_nsec));
+
+	if (trace->ops[i].type != FREE) {
+	    if (p == NULL)
+		app_error("mm_malloc error in eval_mm_latency");
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = trace->ops[i].size;
 	}
     }
 
-    return 1;
+    mem_reset();
 }
 
-/* 
- * eval_libc_speed - This is the function that is used by fcyc() to
- *    measure the running time of the libc malloc package on the set
- *    of traces.
+/*
+ * touch_word - the word the touching replay stores at word i of block index
  */
-static void eval_libc_speed(void *ptr)
+static inline uint64_t touch_word(int index, size_t i)
 {
-    int i;
-    int index, size, newsize;
-    char *p, *newp, *oldp, *block;
-    trace_t *trace = ((speed_t *)ptr)->trace;
-
-    for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
-        case ALLOC: /* malloc */
-	    index = trace->ops[i].index;
-	    size = trace->ops[i].size;
-	    if ((p = malloc(size)) == NULL)
-		unix_error("malloc failed in eval_libc_speed");
-	    trace->blocks[index] = p;
-	    break;
+    return ((uint64_t)index + 1) * 0x9E3779B97F4A7C15ULL + i;
+}
 
-	case REALLOC: /* realloc */
-	    index = trace->ops[i].index;
-	    newsize = trace->ops[i].size;
-	    oldp = trace->blocks[index];
-	    if ((newp = malloc(newsize)) == NULL)
-		unix_error("malloc failed in eval_libc_speed\n");
-            free(oldp);
-	    
-	    trace->blocks[index] = newp;
-	    break;
-	    
-        case FREE: /* free */
-	    index = trace->ops[i].index;
-	    block = trace->blocks[index];
-	    free(block);
-	    break;
-	}
-    }
+/*
+ * touch_step - words between the words of a block that are touched,
+ *     and touch_limit - the number of words of a size-byte block that
+ *     may be touched
+ */
+static inline size_t touch_step(void)
+{
+    return (touch_mode == TOUCH_LINES) ? TOUCH_LINE / sizeof(uint64_t) : 1;
 }
 
-/*************************************
- * Some miscellaneous helper routines
- ************************************/
+static inline size_t touch_limit(int size)
+{
+    size_t n = size / sizeof(uint64_t);
 
+    if (touch_mode == TOUCH_PREFIX && n > touch_prefix / sizeof(uint64_t))
+	n = touch_prefix / sizeof(uint64_t);
+    return n;
+}
 
 /*
- * printresults - prints a performance summary for some malloc package
+ * touch_write - store the touch pattern in block index at p
  */
-static void printresults(int n, stats_t *stats) 
+static void touch_write(uint64_t *p, int size, int index)
 {
-    int i;
-    double secs = 0;
-    double ops = 0;
-    double util = 0;
-    double inst_util = 0;
+    size_t i, n = touch_limit(size), step = touch_step();
 
-    /* Print the individual results for each trace */
-    printf("%5s%7s %5s%7s%7s%10s%6s\n", 
-	   "trace", " valid", "util", "util_i", "ops", "secs", "Kops");
-    for (i=0; i < n; i++) {
+    for (i = 0; i < n; i += step)
+	p[i] = touch_word(index, i);
+}
+
+/*
+ * touch_read - load the touch pattern back from block index at p.
+ *     Returns 0 if --touch-check is on and a word has changed.
+ */
+static int touch_read(uint64_t *p, int size, int index)
+{
+    size_t i, n = touch_limit(size), step = touch_step();
+    uint64_t sum = 0;
+
+    if (touch_check) {
+	for (i = 0; i < n; i += step)
+	    if (p[i] != touch_word(index, i))
+		return 0;
+	return 1;
+    }
+    for (i = 0; i < n; i += step)
+	sum += p[i];
+    touch_sink = sum;
+    return 1;
+}
+
+/*
+ * touch_error - report a touched payload that changed, and exit
+ */
+static void touch_error(int index, int opnum)
+{
+    sprintf(msg, "Payload of block %d changed before line %d, "
+	    "found in eval_mm_touch", index, LINENUM(opnum));
+    app_error(msg);
+}
+
+/*
+ * eval_mm_touch - like eval_mm_speed, but the way a program uses its
+ *     memory: each block is written when it is allocated or resized and
+ *     read back before it is resized or freed, so that where the 
+ *     allocator puts blocks and their metadata shows up in the time
+ */
+static void eval_mm_touch(void *ptr)
+{
+    int i, index, size;
+    char *p;
+    trace_t *trace = ((speed_t *)ptr)->trace;
+
+    if (mm->init() < 0) 
+	app_error("mm_init failed in eval_mm_touch");
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+        switch (trace->ops[i].type) {
+        case ALLOC:
+	    if ((p = mm->malloc(size)) == NULL)
+		app_error("mm_malloc error in eval_mm_touch");
+	    touch_write((uint64_t *)p, size, index);
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    break;
+
+	case REALLOC:
+	    p = trace->blocks[index];
+	    if (!touch_read((uint64_t *)p, trace->block_sizes[index], index))
+		touch_error(index, i);
+	    if ((p = mm_resize(p, trace->block_sizes[index], size)) == NULL)
+		app_error("mm_realloc error in eval_mm_touch");
+	    touch_write((uint64_t *)p, size, index);
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    break;
+
+        case FREE:
+	    p = trace->blocks[index];
+	    if (!touch_read((uint64_t *)p, trace->block_sizes[index], index))
+		touch_error(index, i);
+	    mm->free(p);
+	    break;
+
+	default:
+	    app_error("Nonexistent request type in eval_mm_touch");
+	}
+    }
+
+    mem_reset();
+}
+
+/*
+ * replay_to_peak - run the first end requests of a trace with no checks,
+ *     setting *peak_op to the first of them after which the heap was
+ *     at its largest. Returns the payload bytes live after them.
+ */
+static size_t replay_to_peak(trace_t *trace, int end, int *peak_op)
+{
+    int i, index, size;
+    size_t heap_size, max_heap_size = 0, total_size = 0;
+    char *p;
+
+    if (mm->init() < 0) 
+	app_error("mm_init failed in replay_to_peak");
+    for (i = 0; i < end; i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+	switch (trace->ops[i].type) {
+	case ALLOC:
+	    if ((p = mm->malloc(size)) == NULL)
+		app_error("mm_malloc failed in replay_to_peak");
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    total_size += size;
+	    break;
+	case REALLOC:
+	    if ((p = mm_resize(trace->blocks[index], 
+			       trace->block_sizes[index], size)) == NULL)
+		app_error("mm_realloc failed in replay_to_peak");
+	    total_size += size - trace->block_sizes[index];
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    break;
+	case FREE:
+	    mm->free(trace->blocks[index]);
+	    total_size -= trace->block_sizes[index];
+	    break;
+	default:
+	    app_error("Nonexistent request type in replay_to_peak");
+	}
+	if ((heap_size = mem_heapsize()) > max_heap_size) {
+	    max_heap_size = heap_size;
+	    *peak_op = i;
+	}
+    }
+    return total_size;
+}
+
+/*
+ * replay_capped - replay a trace with mem_heapsize() capped at limit
+ *     bytes (none if 0), checking that blocks do not overlap and that
+ *     realloc keeps their data as eval_mm_valid does. Sets the peak heap
+ *     and payload bytes. Returns 1 if every request was served, 0 if
+ *     one failed at the cap.
+ */
+static int replay_capped(trace_t *trace, int tracenum, size_t limit,
+			 size_t *max_heap, size_t *max_live)
+{
+    range_t *ranges = NULL;
+    int i, j, index, size, oldsize, served = 1;
+    size_t heap_size, total_size = 0;
+    char *p;
+
+    *max_heap = *max_live = 0;
+    mem_set_limit(limit);
+    if (mm->init() < 0) 
+	app_error("mm_init failed in replay_capped");
+    for (i = 0; served && i < trace->num_ops; i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+	switch (trace->ops[i].type) {
+	case ALLOC:
+	    if ((p = mm->malloc(size)) == NULL) {
+		served = 0;
+		break;
+	    }
+	    if (add_range(&ranges, p, size, tracenum, i) == 0)
+		app_error("overlapping block in replay_capped");
+	    memset(p, index & 0xFF, size);
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    total_size += size;
+	    break;
+	case REALLOC:
+	    oldsize = trace->block_sizes[index];
+	    if ((p = mm_resize(trace->blocks[index], oldsize, size)) == NULL) {
+		served = 0;
+		break;
+	    }
+	    remove_range(&ranges, trace->blocks[index]);
+	    if (add_range(&ranges, p, size, tracenum, i) == 0)
+		app_error("overlapping block in replay_capped");
+	    for (j = 0; j < oldsize && j < size; j++)
+		if ((unsigned char)p[j] != (index & 0xFF))
+		    app_error("realloc lost data in replay_capped");
+	    memset(p, index & 0xFF, size);
+	    total_size += size - oldsize;
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    break;
+	case FREE:
+	    remove_range(&ranges, trace->blocks[index]);
+	    mm->free(trace->blocks[index]);
+	    total_size -= trace->block_sizes[index];
+	    break;
+	default:
+	    app_error("Nonexistent request type in replay_capped");
+	}
+	if ((heap_size = mem_heapsize()) > *max_heap)
+	    *max_heap = heap_size;
+	if (total_size > *max_live)
+	    *max_live = total_size;
+    }
+    mem_set_limit(0);
+    mem_reset();
+    clear_ranges(&ranges);
+    return served;
+}
+
+/*
+ * eval_mm_min_heap - binary search for the smallest number of pages
+ *     the trace still completes in, between its peak payload bytes,
+ *     which it can never fit under, and its uncapped peak heap.
+ *     mm.c is not bound to fail under every cap below one it fits in,
+ *     so this is the smallest cap the search found, not a proof.
+ */
+static void eval_mm_min_heap(trace_t *trace, int tracenum, stats_t *stats)
+{
+    size_t lo, hi, mid, max_heap, max_live, ignore;
+
+    if (!replay_capped(trace, tracenum, 0, &max_heap, &max_live))
+	app_error("mm_malloc failed with no cap in eval_mm_min_heap");
+    lo = max_live ? (max_live - 1) / APAGE_SIZE : 0;
+    hi = max_heap / APAGE_SIZE;
+    while (hi - lo > 1) {
+	mid = lo + (hi - lo) / 2;
+	if (replay_capped(trace, tracenum, mid * APAGE_SIZE, &ignore, &ignore))
+	    hi = mid;
+	else
+	    lo = mid;
+    }
+    stats->min_heap = hi * APAGE_SIZE;
+    stats->min_util = stats->min_heap ? (double)max_live / stats->min_heap : 0;
+}
+
+/*
+ * heapwalk - mm_walk callback adding one chunk or block to a heapwalk_t
+ */
+static void heapwalk(void *ptr, size_t size, int kind, void *arg)
+{
+    heapwalk_t *w = (heapwalk_t *)arg;
+    int class;
+
+    switch (kind) {
+    case MM_WALK_CHUNK:
+	w->chunk_bytes += size;
+	w->chunks++;
+	break;
+    case MM_WALK_ALLOC:
+	w->block_bytes += size;
+	w->usable += mm_usable_size(ptr);
+	break;
+    case MM_WALK_FREE:
+	for (class = 0; (size >> class) > 1; class++)
+	    ;
+	w->free_bytes += size;
+	w->free_blocks++;
+	w->free_class[class]++;
+	w->free_class_bytes[class] += size;
+	break;
+    case MM_WALK_TAIL:
+	w->tail_bytes += size;
+	break;
+    }
+}
+
+/*
+ * eval_mm_frag - replay a trace up to the request after which mm.c's
+ *     heap is largest, walk the heap there and print where its bytes
+ *     went: requested payloads, rounding up to usable sizes, block tags,
+ *     free blocks by size, the untouched tail and chunk overhead
+ */
+static void eval_mm_frag(trace_t *trace, int tracenum)
+{
+    heapwalk_t w;
+    int peak_op = 0, i;
+    size_t live, heap_size, overhead;
+    double pct;
+    char range[MAXLINE];
+
+    replay_to_peak(trace, trace->num_ops, &peak_op);
+    mem_reset();
+    live = replay_to_peak(trace, peak_op + 1, &i);
+    heap_size = mem_heapsize();
+    memset(&w, 0, sizeof(w));
+    mm_walk(heapwalk, &w);
+    mem_reset();
+
+    pct = 100.0 / (heap_size ? heap_size : 1);
+    printf("\nHeap of trace %d at its peak, after request %d:\n", 
+	   tracenum, peak_op);
+    printf("%-16s%12zu%7.1f%%\n", "heap", heap_size, 100.0);
+    printf("%-16s%12zu%7.1f%%\n", "requested", live, live * pct);
+    printf("%-16s%12zu%7.1f%%\n", "rounding", 
+	   w.usable - live, (w.usable - live) * pct);
+    printf("%-16s%12zu%7.1f%%\n", "block tags", 
+	   w.block_bytes - w.usable, (w.block_bytes - w.usable) * pct);
+    printf("%-16s%12zu%7.1f%%  in %zu blocks\n", "free blocks", 
+	   w.free_bytes, w.free_bytes * pct, w.free_blocks);
+    printf("%-16s%12zu%7.1f%%\n", "chunk tail", 
+	   w.tail_bytes, w.tail_bytes * pct);
+    overhead = w.chunk_bytes - w.block_bytes - w.free_bytes - w.tail_bytes;
+    printf("%-16s%12zu%7.1f%%  in %zu chunks\n", "chunk overhead", 
+	   overhead, overhead * pct, w.chunks);
+    if (heap_size != w.chunk_bytes)
+	printf("%-16s%12ld%7.1f%%\n", "outside chunks", 
+	       (long)(heap_size - w.chunk_bytes), 
+	       (long)(heap_size - w.chunk_bytes) * pct);
+    if (w.free_blocks > 0)
+	printf("Free blocks by size:\n");
+    for (i = 0; i < 64; i++) {
+	if (w.free_class[i] == 0)
+	    continue;
+	snprintf(range, sizeof(range), "[%zu, %zu)", 
+		 (size_t)1 << i, (size_t)2 << i);
+	printf("  %-20s%8zu blocks%12zu bytes\n", 
+	       range, w.free_class[i], w.free_class_bytes[i]);
+    }
+}
+
+/*
+ * eval_libc_valid - We run this function to make sure that the
+ *    libc malloc can run to completion on the set of traces.
+ *    We'll be conservative and terminate if any libc malloc call fails.
+ *
+ */
+static int eval_libc_valid(trace_t *trace, int tracenum)
+{
+    int i, newsize;
+    char *p, *newp, *oldp;
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* malloc */
+	    if ((p = malloc(trace->ops[i].size)) == NULL) {
+		malloc_error(tracenum, i, "libc malloc failed");
+		unix_error("System message");
+	    }
+	    trace->blocks[trace->ops[i].index] = p;
+	    break;
+
+	case REALLOC: /* realloc */
+            newsize = trace->ops[i].size;
+	    oldp = trace->blocks[trace->ops[i].index];
+	    if ((newp = realloc(oldp, newsize)) == NULL) {
+		malloc_error(tracenum, i, "libc realloc failed");
+		unix_error("System message");
+	    }
+	    trace->blocks[trace->ops[i].index] = newp;
+	    break;
+	    
+        case FREE: /* free */
+	    free(trace->blocks[trace->ops[i].index]);
+	    break;
+
+	default:
+	    app_error("invalid operation type  in eval_libc_valid");
+	}
+    }
+
+    return 1;
+}
+
+/* 
+ * eval_libc_speed - This is the function that is used by fcyc() to
+ *    measure the running time of the libc malloc package on the set
+ *    of traces.
+ */
+static void eval_libc_speed(void *ptr)
+{
+    int i;
+    int index, size, newsize;
+    char *p, *newp, *oldp, *block;
+    trace_t *trace = ((speed_t *)ptr)->trace;
+    perfctr_t *perf = ((speed_t *)ptr)->perf;
+
+    if (perf)
+	perf->runs++;
+    for (i = 0;  i < trace->num_ops;  i++) {
+        switch (trace->ops[i].type) {
+        case ALLOC: /* malloc */
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+	    if ((p = malloc(size)) == NULL)
+		unix_error("malloc failed in eval_libc_speed");
+	    trace->blocks[index] = p;
+	    break;
+
+	case REALLOC: /* realloc */
+	    index = trace->ops[i].index;
+	    newsize = trace->ops[i].size;
+	    oldp = trace->blocks[index];
+	    if ((newp = malloc(newsize)) == NULL)
+		unix_error("malloc failed in eval_libc_speed\n");
+            free(oldp);
+	    
+	    trace->blocks[index] = newp;
+	    break;
+	    
+        case FREE: /* free */
+	    index = trace->ops[i].index;
+	    block = trace->blocks[index];
+	    free(block);
+	    break;
+	}
+    }
+}
+
+/*************************************
+ * Some miscellaneous helper routines
+ ************************************/
+
+
+/*
+ * printresults - prints a performance summary for some malloc package
+ */
+static void printresults(int n, stats_t *stats) 
+{
+    int i;
+    double secs = 0;
+    double ops = 0;
+    double util = 0;
+    double inst_util = 0;
+    double var = 0, secs_min = 0, touch_secs = 0, cold_secs = 0;
+    double rss_util = 0, rss_peak = 0, minflt = 0, min_util = 0;
+    double count[PERF_NCOUNTERS] = {0}, run_count[PERF_NCOUNTERS];
+    int j, one_run = 0;
+
+    /* Print the individual results for each trace */
+    printf("%5s%7s %5s%7s%7s%10s%6s%6s%10s", 
+	   "trace", " valid", "util", "util_i", "ops", "secs", "Kops",
+	   "sd", "min secs");
+    if (cold_cache)
+	printf("%7s", "cKops");
+    if (touch_mode != TOUCH_OFF)
+	printf("%7s", "tKops");
+    if (rss_report)
+	printf("%7s%9s%9s%9s", "util_r", "peak KB", "end KB", "minflt");
+    if (min_heap_report)
+	printf("%9s%7s", "min KB", "util_m");
+    if (perf_events)
+	printf("%8s%6s%8s%8s%8s%8s", 
+	       "cyc/op", "IPC", "L1m/op", "LLCm/op", "TLBm/op", "faults");
+    printf("\n");
+    for (i=0; i < n; i++) {
 	if (stats[i].valid) {
-	    printf("%2d%10s%5.0f%%%5.0f%%%8.0f%10.6f%6.0f\n", 
+	    printf("%2d%10s%5.0f%%%5.0f%%%8.0f%10.6f%6.0f", 
 		   i,
 		   "yes",
 		   stats[i].util*100.0,
@@ -944,7 +1765,50 @@ static void printresults(int n, stats_t *stats)
 		   stats[i].ops,
 		   stats[i].secs,
 		   (stats[i].ops/1e3)/stats[i].secs);
+	    /* One run has no spread to speak of */
+	    if (stats[i].runs > 1)
+		printf("%5.1f%%", stats[i].secs_sd/stats[i].secs*100.0);
+	    else
+		printf("%6s", "-");
+	    printf("%10.6f", stats[i].secs_min);
+	    if (cold_cache && stats[i].cold_secs > 0)
+		printf("%7.0f", (stats[i].ops/1e3)/stats[i].cold_secs);
+	    else if (cold_cache)
+		printf("%7s", "-");
+	    if (touch_mode != TOUCH_OFF && stats[i].touch_secs > 0)
+		printf("%7.0f", (stats[i].ops/1e3)/stats[i].touch_secs);
+	    else if (touch_mode != TOUCH_OFF)
+		printf("%7s", "-");
+	    if (rss_report)
+		printf("%6.0f%%%9zu%9zu%9ld",
+		       stats[i].rss_util*100.0,
+		       stats[i].rss_peak/1024,
+		       stats[i].rss_end/1024,
+		       stats[i].minflt);
+	    if (min_heap_report && stats[i].min_heap > 0)
+		printf("%9zu%6.0f%%", stats[i].min_heap/1024, 
+		       stats[i].min_util*100.0);
+	    else if (min_heap_report)
+		printf("%9s%7s", "-", "-");
+	    if (perf_events) {
+		for (j = 0; j < PERF_NCOUNTERS; j++) {
+		    run_count[j] = stats[i].perf.count[j] / stats[i].perf.runs;
+		    count[j] += run_count[j];
+		}
+		printperf(run_count, stats[i].ops);
+	    }
+	    printf("\n");
 	    secs += stats[i].secs;
+	    var += stats[i].secs_sd * stats[i].secs_sd;
+	    one_run |= (stats[i].runs < 2);
+	    secs_min += stats[i].secs_min;
+	    touch_secs += stats[i].touch_secs;
+	    cold_secs += stats[i].cold_secs;
+	    rss_util += stats[i].rss_util;
+	    if (stats[i].rss_peak > rss_peak)
+		rss_peak = stats[i].rss_peak;
+	    minflt += stats[i].minflt;
+	    min_util += stats[i].min_util;
 	    ops += stats[i].ops;
 	    util += stats[i].util;
 	    inst_util += stats[i].inst_util;
@@ -962,13 +1826,34 @@ static void printresults(int n, stats_t *stats)
 
     /* Print the aggregate results for the set of traces */
     if (errors == 0) {
-	printf("%12s%5.0f%%%5.0f%%%8.0f%10.6f%6.0f\n", 
+	printf("%12s%5.0f%%%5.0f%%%8.0f%10.6f%6.0f", 
 	       "Total       ",
 	       (util/n)*100.0,
 	       (inst_util/n)*100.0,
 	       ops, 
 	       secs,
 	       (ops/1e3)/secs);
+	if (!one_run)
+	    printf("%5.1f%%", sqrt(var)/secs*100.0);
+	else
+	    printf("%6s", "-");
+	printf("%10.6f", secs_min);
+	if (cold_cache && cold_secs > 0)
+	    printf("%7.0f", (ops/1e3)/cold_secs);
+	else if (cold_cache)
+	    printf("%7s", "-");
+	if (touch_mode != TOUCH_OFF && touch_secs > 0)
+	    printf("%7.0f", (ops/1e3)/touch_secs);
+	else if (touch_mode != TOUCH_OFF)
+	    printf("%7s", "-");
+	if (rss_report)
+	    printf("%6.0f%%%9.0f%9s%9.0f", (rss_util/n)*100.0, 
+		   rss_peak/1024, "-", minflt);
+	if (min_heap_report)
+	    printf("%9s%6.0f%%", "-", (min_util/n)*100.0);
+	if (perf_events)
+	    printperf(count, ops);
+	printf("\n");
     }
     else {
 	printf("%12s%6s%6s%8s%10s%6s\n", 
@@ -982,6 +1867,1124 @@ static void printresults(int n, stats_t *stats)
 
 }
 
+/*
+ * printbackends - Print util, util_i and Kops of every allocator on
+ *     every trace side by side, mm.c first
+ */
+static void printbackends(int n, int num_allocs, allocator_t *allocs,
+			  stats_t **stats)
+{
+    int i, k, valid;
+    double util, inst_util, ops, secs;
+
+    printf("%5s", "");
+    for (k = 0; k < num_allocs; k++)
+	printf("  %21.21s", allocs[k].name);
+    printf("\n%5s", "trace");
+    for (k = 0; k < num_allocs; k++)
+	printf("  %6s%7s%8s", "util", "util_i", "Kops");
+    printf("\n");
+    for (i = 0; i < n; i++) {
+	printf("%5d", i);
+	for (k = 0; k < num_allocs; k++) {
+	    if (stats[k][i].valid)
+		printf("  %5.0f%%%6.0f%%%8.0f", 
+		       stats[k][i].util*100.0,
+		       stats[k][i].inst_util*100.0,
+		       (stats[k][i].ops/1e3)/stats[k][i].secs);
+	    else
+		printf("  %6s%7s%8s", "-", "-", "-");
+	}
+	printf("\n");
+    }
+
+    /* An allocator gets a total only if it ran every trace */
+    printf("%5s", "Total");
+    for (k = 0; k < num_allocs; k++) {
+	util = inst_util = ops = secs = 0;
+	for (i = 0, valid = 1; i < n; i++) {
+	    valid &= stats[k][i].valid;
+	    util += stats[k][i].util;
+	    inst_util += stats[k][i].inst_util;
+	    ops += stats[k][i].ops;
+	    secs += stats[k][i].secs;
+	}
+	if (valid)
+	    printf("  %5.0f%%%6.0f%%%8.0f", 
+		   (util/n)*100.0, (inst_util/n)*100.0, (ops/1e3)/secs);
+	else
+	    printf("  %6s%7s%8s", "-", "-", "-");
+    }
+    printf("\n");
+}
+
+/*
+ * eval_mm_traces - evaluate the current allocator on every trace, 
+ *     streamed (-S), in worker processes (-j) or one after another
+ */
+static void eval_mm_traces(int n, char **tracefiles, stats_t *stats,
+			   latency_t *lat, size_t profile_bytes, 
+			   int jobs, int serial_speed, int stream)
+{
+    trace_t *trace;
+    int i;
+
+    if (stream) {
+	for (i=0; i < n; i++)
+	    eval_mm_stream(tracefiles[i], i, &stats[i]);
+    }
+    else if (jobs > 1) {
+	eval_mm_parallel(n, tracefiles, stats, lat, 
+			 profile_bytes, !serial_speed, jobs);
+
+	/* Time the valid traces now that nothing else is running */
+	for (i=0; serial_speed && i < n; i++) {
+	    if (!stats[i].valid)
+		continue;
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    time_mm_trace(trace, &stats[i], lat ? lat[i] : NULL);
+	    free_trace(trace);
+	}
+    }
+    else {
+	for (i=0; i < n; i++)
+	    eval_mm_trace(tracefiles[i], i, &stats[i], 
+			  lat ? lat[i] : NULL, profile_bytes, 1);
+    }
+}
+
+/*
+ * eval_mm_trace - check the mm package for correctness on one trace,
+ *     then measure its utilization and, if run_speed, its throughput
+ */
+static void eval_mm_trace(char *tracefile, int tracenum, stats_t *stats,
+			  latency_t lat, size_t profile_bytes, int run_speed)
+{
+    static range_t *ranges = NULL; /* keeps track of block extents */
+    trace_t *trace;
+    timeline_t *tl;
+
+    trace = read_trace(tracedir, tracefile);
+    stats->ops = trace->num_ops;
+    if (verbose > 1)
+	printf("Checking mm_malloc for correctness, ");
+    stats->valid = eval_mm_valid(trace, tracenum, &ranges);
+    if (stats->valid) {
+	if (verbose > 1)
+	    printf("efficiency, ");
+	if (profile_bytes)
+	    mm_profile_start(profile_bytes);
+	tl = timeline_open(tracefile, trace->num_ops);
+	stats->util = eval_mm_util(trace, tracenum, &ranges, &stats->inst_util,
+				   tl, rss_report ? stats : NULL);
+	timeline_close(tl);
+	if (profile_bytes) {
+	    mm_profile_stop();
+	    write_profile(tracefile);
+	}
+
+	/* Their replays would land in the profile, so they come after */
+	if (frag_report && mm == &mm_builtin)
+	    eval_mm_frag(trace, tracenum);
+	if (min_heap_report && mm == &mm_builtin)
+	    eval_mm_min_heap(trace, tracenum, stats);
+	if (run_speed)
+	    time_mm_trace(trace, stats, lat);
+	else if (verbose > 1)
+	    printf("\n");
+    }
+    free_trace(trace);
+}
+
+/*
+ * time_mm_trace - measure the throughput of the mm package on a trace,
+ *     and with -L the latency of each of its requests
+ */
+static void time_mm_trace(trace_t *trace, stats_t *stats, latency_t lat)
+{
+    speed_t speed_params;
+
+    speed_params.trace = trace;
+    speed_params.perf = perf_events ? &stats->perf : NULL;
+    if (verbose > 1)
+	printf("and performance.\n");
+
+    /* 
+     * The counters run across all the runs, warmups included, rather
+     * than being switched on and off inside the timed function, where
+     * the ioctls would be timed too; each run just counts itself.
+     */
+    if (perf_events)
+	perfctr_start();
+    stats->secs = fsecs(eval_mm_speed, &speed_params);
+    if (perf_events)
+	perfctr_stop(&stats->perf);
+    fsecs_spread(&stats->secs_sd, &stats->secs_min, &stats->runs);
+    if (verbose > 1)
+	printf("Timed %d runs.\n", stats->runs);
+
+    /* As are runs that start with nothing of the trace or heap cached */
+    if (cold_cache) {
+	speed_params.perf = NULL;
+	set_fsecs_prep(flush_caches);
+	stats->cold_secs = fsecs(eval_mm_speed, &speed_params);
+	set_fsecs_prep(NULL);
+    }
+
+    /* Touching the payloads is timed apart, so secs stays comparable */
+    if (touch_mode != TOUCH_OFF) {
+	speed_params.perf = NULL;
+	stats->touch_secs = fsecs(eval_mm_touch, &speed_params);
+    }
+
+    /* Timing each request slows it down, so keep it out of secs */
+    if (lat)
+	eval_mm_latency(trace, lat);
+}
+
+/*
+ * flush_caches - evict the trace, the driver's state and whatever heap
+ *     survived from the data caches before a --cold run
+ */
+static void flush_caches(void *arg)
+{
+    fcyc_clear_cache();
+}
+
+/*
+ * eval_mm_stream - evaluate the mm package on a trace streamed from
+ *     its file a window at a time, for traces too large for read_trace.
+ *     Live blocks are tracked in an idmap and a range tree, so memory
+ *     grows with the number of live blocks, not the trace length.
+ */
+static void eval_mm_stream(char *tracefile, int tracenum, stats_t *stats)
+{
+    if (verbose > 1)
+	printf("Checking mm_malloc for correctness and efficiency, ");
+    stats->valid = stream_mm_util(tracefile, tracenum, stats);
+    if (stats->valid) {
+	if (verbose > 1)
+	    printf("and performance.\n");
+	stats->secs = stats->secs_min = stream_mm_speed(tracefile);
+	stats->runs = 1;
+    }
+    else if (verbose > 1)
+	printf("\n");
+}
+
+/*
+ * stream_mm_util - replay a streamed trace, checking every payload as
+ *     eval_mm_valid does and measuring utilization as eval_mm_util does
+ */
+static int stream_mm_util(char *tracefile, int tracenum, stats_t *stats)
+{
+    trace_stream_t *s = open_trace_stream(tracedir, tracefile);
+    range_t *ranges = NULL;
+    idmap_t blocks;
+    idmap_entry_t *e;
+    traceop_t *ops;
+    int i, j, n, opnum = 0, valid = 1, oldsize;
+    char *p;
+    size_t max_total_size = 0, max_heap_size = 0;
+    size_t heap_size, total_size = 0;
+    double ratio, ratio_frac, accum_ratio_frac = 1.0, accum_ratio_exp = 0.0;
+    int ratio_exp;
+    timeline_t *tl = timeline_open(tracefile, s->hdr.num_ops);
+    rss_t r = {0};
+
+    stats->ops = s->hdr.num_ops;
+    idmap_init(&blocks);
+    if (rss_report)
+	rss_start(&r);
+    if (mm->init() < 0) {
+	malloc_error(tracenum, 0, "mm_init failed.");
+	valid = 0;
+    }
+
+    while (valid && (n = read_trace_window(s, &ops)) > 0) {
+	for (i = 0; valid && i < n; i++, opnum++) {
+	    switch (ops[i].type) {
+	    case ALLOC:
+	    case REALLOC:
+		oldsize = 0;
+		if (ops[i].type == ALLOC) {
+		    e = idmap_insert(&blocks, ops[i].index);
+		    p = mm->malloc(ops[i].size);
+		}
+		else {
+		    if ((e = idmap_find(&blocks, ops[i].index)) == NULL)
+			app_error("realloc of a free block in stream_mm_util");
+		    remove_range(&ranges, e->ptr);
+		    total_size -= e->size;
+		    oldsize = (e->size < ops[i].size) ? e->size : ops[i].size;
+		    p = mm_resize(e->ptr, e->size, ops[i].size);
+		}
+		if (p == NULL) {
+		    malloc_error(tracenum, opnum, "mm_malloc failed.");
+		    valid = 0;
+		    break;
+		}
+		if (add_range(&ranges, p, ops[i].size, tracenum, opnum) == 0) {
+		    valid = 0;
+		    break;
+		}
+
+		/* 
+		 * As in eval_mm_valid, check a realloc kept the old data,
+		 * then fill the block with the low byte of its id. The
+		 * fill touches every page, so --rss needs no rss_touch.
+		 */
+		for (j = 0; j < oldsize; j++)
+		    if ((unsigned char)p[j] != (ops[i].index & 0xFF))
+			break;
+		if (j < oldsize) {
+		    malloc_error(tracenum, opnum, "mm_realloc did not preserve "
+				 "the data from old block");
+		    valid = 0;
+		    break;
+		}
+		memset(p, ops[i].index & 0xFF, ops[i].size);
+		e->ptr = p;
+		e->size = ops[i].size;
+		total_size += e->size;
+		break;
+
+	    case FREE:
+		if ((e = idmap_find(&blocks, ops[i].index)) == NULL)
+		    app_error("free of a free block in stream_mm_util");
+		remove_range(&ranges, e->ptr);
+		mm->free(e->ptr);
+		total_size -= e->size;
+		idmap_remove(&blocks, e);
+		break;
+
+	    default:
+		app_error("Nonexistent request type in stream_mm_util");
+	    }
+
+	    /* Update statistics as eval_mm_util does */
+	    if (total_size > max_total_size)
+		max_total_size = total_size;
+	    heap_size = mem_heapsize();
+	    if (heap_size > max_heap_size)
+		max_heap_size = heap_size;
+	    ratio = (double)(total_size + 1) / (heap_size + 1);
+	    ratio_frac = frexp(ratio, &ratio_exp);
+	    accum_ratio_frac *= ratio_frac;
+	    accum_ratio_exp += ratio_exp;
+	    accum_ratio_frac = frexp(accum_ratio_frac, &ratio_exp);
+	    accum_ratio_exp += ratio_exp;
+	    if (tl)
+		timeline_record(tl, opnum, total_size, heap_size);
+	    if (rss_report)
+		rss_sample(&r, heap_size);
+	}
+    }
+
+    timeline_close(tl);
+    if (rss_report)
+	rss_finish(&r, max_total_size, stats);
+    mem_reset();
+    clear_ranges(&ranges);
+    idmap_free(&blocks);
+    close_trace_stream(s);
+
+    if (valid) {
+	stats->inst_util = accum_ratio_frac * 
+	    pow(2, accum_ratio_exp / stats->ops);
+	stats->util = (double)max_total_size / max_heap_size;
+    }
+    return valid;
+}
+
+/*
+ * stream_mm_speed - replay a streamed trace once with no checks, 
+ *     returning the seconds spent in it, not reading the file. As in
+ *     eval_mm_speed, mm_init and mem_reset are part of the replay.
+ */
+static double stream_mm_speed(char *tracefile)
+{
+    trace_stream_t *s = open_trace_stream(tracedir, tracefile);
+    idmap_t blocks;
+    idmap_entry_t *e;
+    traceop_t *ops;
+    struct timespec t0, t1;
+    double secs = 0;
+    int i, n;
+
+    idmap_init(&blocks);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (mm->init() < 0) 
+	app_error("mm_init failed in stream_mm_speed");
+
+    for (;;) {
+	/* The clock stops while the next window is read */
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	secs += (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+	n = read_trace_window(s, &ops);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	if (n == 0)
+	    break;
+	for (i = 0; i < n; i++) {
+	    switch (ops[i].type) {
+	    case ALLOC:
+		e = idmap_insert(&blocks, ops[i].index);
+		if ((e->ptr = mm->malloc(ops[i].size)) == NULL)
+		    app_error("mm_malloc error in stream_mm_speed");
+		e->size = ops[i].size;
+		break;
+	    case REALLOC:
+		e = idmap_find(&blocks, ops[i].index);
+		if ((e->ptr = mm_resize(e->ptr, e->size, ops[i].size)) == NULL)
+		    app_error("mm_realloc error in stream_mm_speed");
+		e->size = ops[i].size;
+		break;
+	    case FREE:
+		e = idmap_find(&blocks, ops[i].index);
+		mm->free(e->ptr);
+		idmap_remove(&blocks, e);
+		break;
+	    }
+	}
+    }
+
+    mem_reset();
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    secs += (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+    idmap_free(&blocks);
+    close_trace_stream(s);
+    return secs;
+}
+
+/*
+ * eval_mm_parallel - run eval_mm_trace on every trace in a worker
+ *     process of its own, at most jobs at a time. Each worker sends
+ *     back its stats, its error count and, with -L, its latencies
+ *     through a pipe. memlib and mm.c keep global state, so one process
+ *     per trace is what keeps the evaluations apart. Each running worker
+ *     holds one of jobs slots, which picks the CPU it is pinned to.
+ */
+static void eval_mm_parallel(int n, char **tracefiles, stats_t *stats,
+			     latency_t *lat, size_t profile_bytes, 
+			     int run_speed, int jobs)
+{
+    pid_t *pids;
+    struct pollfd *fds;
+    int *slot, *slot_used;
+    int i, s, next = 0, running = 0, status, worker_errors;
+    int fd[2];
+    ssize_t len, got;
+    char *buf;
+    size_t size = sizeof(stats_t) + sizeof(int) + (lat ? sizeof(latency_t) : 0);
+
+    if ((pids = calloc(n, sizeof(pid_t))) == NULL ||
+	(fds = calloc(n, sizeof(struct pollfd))) == NULL ||
+	(slot = calloc(n, sizeof(int))) == NULL ||
+	(slot_used = calloc(jobs, sizeof(int))) == NULL ||
+	(buf = malloc(size)) == NULL)
+	unix_error("calloc failed in eval_mm_parallel");
+    for (i = 0; i < n; i++)
+	fds[i].fd = -1;
+
+    while (next < n || running > 0) {
+	/* Start workers until jobs are running */
+	while (next < n && running < jobs) {
+	    if (pipe(fd) < 0)
+		unix_error("pipe failed in eval_mm_parallel");
+	    for (s = 0; slot_used[s]; s++)
+		;
+	    slot[next] = s;
+	    slot_used[s] = 1;
+	    fflush(stdout);
+	    if ((pids[next] = fork()) < 0)
+		unix_error("fork failed in eval_mm_parallel");
+	    if (pids[next] == 0) {
+		close(fd[0]);
+		pin_worker(slot[next]);
+		/* The parent's counters count the parent, not us */
+		if (perf_events) {
+		    perfctr_close();
+		    perf_events = perfctr_open();
+		}
+		eval_mm_trace(tracefiles[next], next, &stats[next], 
+			      lat ? lat[next] : NULL, profile_bytes, run_speed);
+		memcpy(buf, &stats[next], sizeof(stats_t));
+		memcpy(buf + sizeof(stats_t), &errors, sizeof(int));
+		if (lat)
+		    memcpy(buf + sizeof(stats_t) + sizeof(int), 
+			   lat[next], sizeof(latency_t));
+		fflush(stdout);
+		for (got = 0; got < size; got += len)
+		    if ((len = write(fd[1], buf + got, size - got)) <= 0)
+			_exit(1);
+		_exit(0);
+	    }
+	    close(fd[1]);
+	    fds[next].fd = fd[0];
+	    fds[next].events = POLLIN;
+	    next++;
+	    running++;
+	}
+
+	/* Collect the results of whichever worker finishes first */
+	if (poll(fds, next, -1) < 0)
+	    unix_error("poll failed in eval_mm_parallel");
+	for (i = 0; i < next; i++) {
+	    if (fds[i].fd < 0 || fds[i].revents == 0)
+		continue;
+	    for (got = 0; got < size; got += len)
+		if ((len = read(fds[i].fd, buf + got, size - got)) <= 0)
+		    break;
+	    close(fds[i].fd);
+	    fds[i].fd = -1;
+	    running--;
+	    slot_used[slot[i]] = 0;
+	    waitpid(pids[i], &status, 0);
+
+	    if (got == size && WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+		memcpy(&stats[i], buf, sizeof(stats_t));
+		memcpy(&worker_errors, buf + sizeof(stats_t), sizeof(int));
+		errors += worker_errors;
+		if (lat)
+		    memcpy(lat[i], buf + sizeof(stats_t) + sizeof(int), 
+			   sizeof(latency_t));
+	    }
+	    else {
+		if (WIFSIGNALED(status))
+		    printf("ERROR [trace %d]: worker killed by signal %d\n", 
+			   i, WTERMSIG(status));
+		else
+		    printf("ERROR [trace %d]: worker exited without results\n",
+			   i);
+		errors++;
+		stats[i].valid = 0;
+	    }
+	}
+    }
+
+    free(buf);
+    free(slot_used);
+    free(slot);
+    free(fds);
+    free(pids);
+}
+
+/*
+ * pin_worker - move a worker onto the slot'th CPU it is allowed to run
+ *     on (wrapping around if there are fewer), so that ftimer_mono, which
+ *     pins to whatever CPU it starts on, never has two timing workers
+ *     pinned to one CPU while there are CPUs enough to go around
+ */
+static void pin_worker(int slot)
+{
+    cpu_set_t allowed, one;
+    int cpu, ncpus;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0 ||
+	(ncpus = CPU_COUNT(&allowed)) == 0)
+	return;
+    slot %= ncpus;
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+	if (CPU_ISSET(cpu, &allowed) && slot-- == 0)
+	    break;
+    CPU_ZERO(&one);
+    CPU_SET(cpu, &one);
+    sched_setaffinity(0, sizeof(one), &one);
+}
+
+/*
+ * printperf - print the -e columns of a results row: events per 
+ *     request, instructions per cycle and page faults per run, given
+ *     the event counts of one run of ops requests
+ */
+static void printperf(double *count, double ops)
+{
+    if (perfctr_available(PERF_CYCLES))
+	printf("%8.1f", count[PERF_CYCLES] / ops);
+    else
+	printf("%8s", "-");
+    if (perfctr_available(PERF_CYCLES) && perfctr_available(PERF_INSTRUCTIONS)
+	&& count[PERF_CYCLES] > 0)
+	printf("%6.2f", count[PERF_INSTRUCTIONS] / count[PERF_CYCLES]);
+    else
+	printf("%6s", "-");
+    if (perfctr_available(PERF_L1D_MISSES))
+	printf("%8.3f", count[PERF_L1D_MISSES] / ops);
+    else
+	printf("%8s", "-");
+    if (perfctr_available(PERF_LLC_MISSES))
+	printf("%8.3f", count[PERF_LLC_MISSES] / ops);
+    else
+	printf("%8s", "-");
+    if (perfctr_available(PERF_DTLB_MISSES))
+	printf("%8.3f", count[PERF_DTLB_MISSES] / ops);
+    else
+	printf("%8s", "-");
+    if (perfctr_available(PERF_PAGE_FAULTS))
+	printf("%8.0f", count[PERF_PAGE_FAULTS]);
+    else
+	printf("%8s", "-");
+}
+
+/*
+ * printlatency - print p50/p99/p99.9/max request latencies in ns 
+ *     for each type of request in each valid trace
+ */
+static void printlatency(int n, stats_t *stats, latency_t *lat)
+{
+    static char *names[3] = {"malloc", "free", "realloc"};
+    int i, t;
+    hist_t *h;
+
+    printf("Request latency (ns):\n");
+    printf("%5s %-8s %8s %8s %8s %8s %8s\n", 
+	   "trace", "request", "count", "p50", "p99", "p99.9", "max");
+    for (i=0; i < n; i++) {
+	if (!stats[i].valid)
+	    continue;
+	for (t = 0; t < 3; t++) {
+	    h = &lat[i][t];
+	    if (h->count == 0)
+		continue;
+	    printf("%2d    %-8s %8lu %8lu %8lu %8lu %8lu\n", i, names[t], 
+		   (unsigned long)h->count,
+		   (unsigned long)hist_percentile(h, 50),
+		   (unsigned long)hist_percentile(h, 99),
+		   (unsigned long)hist_percentile(h, 99.9),
+		   (unsigned long)h->max);
+	}
+    }
+}
+
+/*
+ * write_profile - write the heap profile sampled for a trace to 
+ *     <trace name>.heap in the current directory
+ */
+static void write_profile(char *tracefile)
+{
+    FILE *out;
+    char path[MAXLINE];
+    char *name = strrchr(tracefile, '/');
+
+    snprintf(path, sizeof(path), "%s.heap", name ? name + 1 : tracefile);
+    if ((out = fopen(path, "w")) == NULL) {
+	printf("Could not open %s in write_profile: %s\n", 
+	       path, strerror(errno));
+	exit(1);
+    }
+    mm_profile_dump(out);
+    fclose(out);
+    if (verbose > 1)
+	printf("Wrote heap profile to %s\n", path);
+}
+
+/*
+ * open_results - open a file for --json or --csv, exiting if we can't
+ */
+static FILE *open_results(char *path)
+{
+    FILE *out;
+
+    if ((out = fopen(path, "w")) == NULL) {
+	printf("Could not open %s: %s\n", path, strerror(errno));
+	exit(1);
+    }
+    return out;
+}
+
+/*
+ * totals - sum the results over the traces, into a stats_t whose valid
+ *     says whether every trace was valid
+ */
+static void totals(int n, stats_t *stats, stats_t *total)
+{
+    int i;
+
+    memset(total, 0, sizeof(*total));
+    total->valid = 1;
+    for (i = 0; i < n; i++) {
+	total->valid &= stats[i].valid;
+	if (i == 0 || stats[i].runs < total->runs)
+	    total->runs = stats[i].runs;
+	total->ops += stats[i].ops;
+	total->secs += stats[i].secs;
+	total->secs_sd += stats[i].secs_sd * stats[i].secs_sd;
+	total->secs_min += stats[i].secs_min;
+	total->touch_secs += stats[i].touch_secs;
+	total->cold_secs += stats[i].cold_secs;
+	total->util += stats[i].util / n;
+	total->inst_util += stats[i].inst_util / n;
+    }
+    total->secs_sd = sqrt(total->secs_sd);
+}
+
+/*
+ * json_results - write the results of one trace or the totals as the
+ *     rest of a JSON object, null where there are none
+ */
+static void json_results(FILE *out, stats_t *stats)
+{
+    if (stats->valid) {
+	fprintf(out, "\"util\": %.4f, \"util_i\": %.4f, \"ops\": %.0f, "
+		"\"secs\": %.6f, \"kops\": %.1f, ", 
+		stats->util, stats->inst_util, stats->ops, 
+		stats->secs, (stats->ops/1e3)/stats->secs);
+	if (stats->runs > 1)
+	    fprintf(out, "\"secs_sd\": %.6f, ", stats->secs_sd);
+	else
+	    fprintf(out, "\"secs_sd\": null, ");
+	fprintf(out, "\"secs_min\": %.6f, ", stats->secs_min);
+    }
+    else
+	fprintf(out, "\"util\": null, \"util_i\": null, \"ops\": %.0f, "
+		"\"secs\": null, \"kops\": null, \"secs_sd\": null, "
+		"\"secs_min\": null, ", stats->ops);
+    if (stats->valid && stats->touch_secs > 0)
+	fprintf(out, "\"touch_kops\": %.1f, ", 
+		(stats->ops/1e3)/stats->touch_secs);
+    else
+	fprintf(out, "\"touch_kops\": null, ");
+    if (stats->valid && stats->cold_secs > 0)
+	fprintf(out, "\"cold_kops\": %.1f}", 
+		(stats->ops/1e3)/stats->cold_secs);
+    else
+	fprintf(out, "\"cold_kops\": null}");
+}
+
+/*
+ * write_json - write the per-trace results, their totals and the perf
+ *     index as a JSON object; invalid traces have null results
+ */
+static void write_json(char *path, int n, char **tracefiles, stats_t *stats,
+		       double perfindex)
+{
+    FILE *out = open_results(path);
+    stats_t total;
+    char *f;
+    int i;
+
+    fprintf(out, "{\n  \"traces\": [\n");
+    for (i = 0; i < n; i++) {
+	fprintf(out, "    {\"trace\": %d, \"file\": \"", i);
+	for (f = tracefiles[i]; *f; f++)
+	    fprintf(out, (*f == '"' || *f == '\\') ? "\\%c" : "%c", *f);
+	fprintf(out, "\", \"valid\": %s, ", stats[i].valid ? "true" : "false");
+	json_results(out, &stats[i]);
+	fprintf(out, (i < n - 1) ? ",\n" : "\n");
+    }
+
+    totals(n, stats, &total);
+    fprintf(out, "  ],\n  \"total\": {\"valid\": %s, ", 
+	    total.valid ? "true" : "false");
+    json_results(out, &total);
+    fprintf(out, ",\n  \"perfidx\": %.1f,\n  \"errors\": %d\n}\n", 
+	    perfindex, errors);
+    fclose(out);
+}
+
+/*
+ * csv_results - write the results of one trace or the totals as CSV
+ *     fields from util through cold_kops, empty where there are none
+ */
+static void csv_results(FILE *out, stats_t *stats)
+{
+    if (stats->valid) {
+	fprintf(out, "%.4f,%.4f,%.0f,%.6f,%.1f,", 
+		stats->util, stats->inst_util, stats->ops, 
+		stats->secs, (stats->ops/1e3)/stats->secs);
+	if (stats->runs > 1)
+	    fprintf(out, "%.6f", stats->secs_sd);
+	fprintf(out, ",%.6f,", stats->secs_min);
+    }
+    else
+	fprintf(out, ",,%.0f,,,,,", stats->ops);
+    if (stats->valid && stats->touch_secs > 0)
+	fprintf(out, "%.1f", (stats->ops/1e3)/stats->touch_secs);
+    fprintf(out, ",");
+    if (stats->valid && stats->cold_secs > 0)
+	fprintf(out, "%.1f", (stats->ops/1e3)/stats->cold_secs);
+}
+
+/*
+ * write_csv - write one row per trace and a "total" row carrying the
+ *     perf index; invalid traces have empty results. check_baseline
+ *     reads this format back.
+ */
+static void write_csv(char *path, int n, char **tracefiles, stats_t *stats,
+		      double perfindex)
+{
+    FILE *out = open_results(path);
+    stats_t total;
+    int i;
+
+    fprintf(out, "trace,file,valid,util,util_i,ops,secs,kops,secs_sd,secs_min,"
+	    "touch_kops,cold_kops,perfidx\n");
+    for (i = 0; i < n; i++) {
+	fprintf(out, "%d,%s,%d,", i, tracefiles[i], stats[i].valid);
+	csv_results(out, &stats[i]);
+	fprintf(out, ",\n");
+    }
+
+    totals(n, stats, &total);
+    fprintf(out, "total,,%d,", total.valid);
+    csv_results(out, &total);
+    fprintf(out, ",%.1f\n", perfindex);
+    fclose(out);
+}
+
+/*
+ * regressed - report and return 1 if value fell more than tolerance
+ *     percent below the baseline
+ */
+static int regressed(int tracenum, char *what, double value, double base,
+		     double tolerance)
+{
+    if (value >= base * (1 - tolerance / 100))
+	return 0;
+    printf("REGRESSION [trace %d]: %s %.4g is %.1f%% below the baseline %.4g\n",
+	   tracenum, what, value, (1 - value / base) * 100, base);
+    return 1;
+}
+
+/*
+ * csv_fields - split a CSV line in place at its commas into at most max
+ *     fields, returning how many there are; empty fields are ""
+ */
+static int csv_fields(char *line, char **field, int max)
+{
+    int n = 0;
+
+    line[strcspn(line, "\r\n")] = '\0';
+    while (n < max) {
+	field[n++] = line;
+	if ((line = strchr(line, ',')) == NULL)
+	    break;
+	*line++ = '\0';
+    }
+    return n;
+}
+
+/*
+ * check_baseline - compare each trace with its row, by file name, in a
+ *     CSV file written by an earlier --csv run. Returns the number of
+ *     regressions: a trace no longer valid, a util or util_i more than
+ *     tolerance percent lower, or a Kops more than kops_tolerance
+ *     percent lower. Run-to-run noise in Kops is far larger than in
+ *     util, so the Kops allowance also widens to twice the larger sd of
+ *     a run, in either this run or the baseline. Traces not in both are
+ *     skipped.
+ */
+static int check_baseline(char *path, double tolerance, double kops_tolerance,
+			  int n, char **tracefiles, stats_t *stats)
+{
+    FILE *in;
+    char line[MAXLINE], *field[9];
+    int i, nf, count = 0;
+    double secs, noise;
+
+    if ((in = fopen(path, "r")) == NULL) {
+	printf("Could not open baseline %s: %s\n", path, strerror(errno));
+	exit(1);
+    }
+    while (fgets(line, sizeof(line), in) != NULL) {
+	/* trace,file,valid,util,util_i,ops,secs,kops,secs_sd */
+	if ((nf = csv_fields(line, field, 9)) < 8 ||
+	    !isdigit((unsigned char)field[0][0]) || atoi(field[2]) == 0)
+	    continue;
+	for (i = 0; i < n && strcmp(tracefiles[i], field[1]) != 0; i++)
+	    ;
+	if (i == n)
+	    continue;
+	if (!stats[i].valid) {
+	    printf("REGRESSION [trace %d]: no longer valid\n", i);
+	    count++;
+	    continue;
+	}
+	count += regressed(i, "util", stats[i].util, atof(field[3]), tolerance);
+	count += regressed(i, "util_i", stats[i].inst_util, atof(field[4]), 
+			   tolerance);
+
+	noise = 0;
+	secs = atof(field[6]);
+	if (secs > 0 && nf > 8)
+	    noise = 200 * atof(field[8]) / secs;
+	if (stats[i].runs > 1 && 200 * stats[i].secs_sd / stats[i].secs > noise)
+	    noise = 200 * stats[i].secs_sd / stats[i].secs;
+	count += regressed(i, "Kops", (stats[i].ops/1e3)/stats[i].secs, 
+			   atof(field[7]), 
+			   (noise > kops_tolerance) ? noise : kops_tolerance);
+    }
+    fclose(in);
+    return count;
+}
+
+/*
+ * timeline_open - with --timeline, start <trace name>.timeline.csv in
+ *     the current directory for mm.c on a trace of num_ops requests;
+ *     otherwise return NULL
+ */
+static timeline_t *timeline_open(char *tracefile, long num_ops)
+{
+    timeline_t *tl;
+    char path[MAXLINE];
+    char *name = strrchr(tracefile, '/');
+
+    if (timeline_every == 0 || mm != &mm_builtin)
+	return NULL;
+    if ((tl = (timeline_t *)calloc(1, sizeof(timeline_t))) == NULL)
+	unix_error("calloc failed in timeline_open");
+    snprintf(path, sizeof(path), "%s.timeline.csv", name ? name + 1 : tracefile);
+    if ((tl->out = fopen(path, "w")) == NULL) {
+	printf("Could not open %s in timeline_open: %s\n", 
+	       path, strerror(errno));
+	exit(1);
+    }
+    tl->every = timeline_every;
+    tl->last = num_ops - 1;
+    fprintf(tl->out, "op,live,heap,free_blocks\n");
+    if (verbose > 1)
+	printf("writing %s, ", path);
+    return tl;
+}
+
+/*
+ * timeline_record - note the live and heap bytes after request opnum,
+ *     writing a row with their peaks and the current number of free 
+ *     blocks at the end of every tl->every requests and of the trace
+ */
+static void timeline_record(timeline_t *tl, long opnum, size_t live, 
+			    size_t heap)
+{
+    struct mm_stats st;
+
+    if (live > tl->live)
+	tl->live = live;
+    if (heap > tl->heap)
+	tl->heap = heap;
+    if (++tl->ops < tl->every && opnum < tl->last)
+	return;
+    mm_stats(&st);
+    fprintf(tl->out, "%ld,%zu,%zu,%zu\n", 
+	    opnum, tl->live, tl->heap, st.free_blocks);
+    tl->ops = 0;
+    tl->live = tl->heap = 0;
+}
+
+/*
+ * timeline_close - finish and close a timeline, if there is one
+ */
+static void timeline_close(timeline_t *tl)
+{
+    if (tl == NULL)
+	return;
+    fclose(tl->out);
+    free(tl);
+}
+
+/*
+ * minor_faults - the minor page faults of the driver so far
+ */
+static long minor_faults(void)
+{
+    struct rusage ru;
+
+    if (getrusage(RUSAGE_SELF, &ru) < 0)
+	unix_error("getrusage failed in minor_faults");
+    return ru.ru_minflt;
+}
+
+/*
+ * rss_start - with --rss, start sampling resident memory for a trace
+ */
+static void rss_start(rss_t *r)
+{
+    r->sampled_heap = 0;
+    r->peak = 0;
+    r->minflt = minor_faults();
+}
+
+/*
+ * rss_touch - write one byte in each page of a new payload, as the
+ *     program it came from would have, so that its pages are resident
+ */
+static void rss_touch(char *p, int size)
+{
+    int i;
+
+    for (i = 0; i < size; i += APAGE_SIZE)
+	p[i] = 0;
+    if (size > 0)
+	p[size - 1] = 0;
+}
+
+/*
+ * rss_sample - sample the resident heap bytes after a request, if the
+ *     heap has grown enough since the last sample
+ */
+static void rss_sample(rss_t *r, size_t heap_size)
+{
+    size_t resident;
+
+    if (heap_size <= r->sampled_heap + r->sampled_heap / RSS_GROWTH)
+	return;
+    r->sampled_heap = heap_size;
+    resident = mem_resident();
+    if (resident > r->peak)
+	r->peak = resident;
+}
+
+/*
+ * rss_finish - take the last sample of a trace, before its heap is
+ *     unmapped, and fill in the --rss fields of its stats
+ */
+static void rss_finish(rss_t *r, size_t max_total_size, stats_t *stats)
+{
+    stats->rss_end = mem_resident();
+    if (stats->rss_end > r->peak)
+	r->peak = stats->rss_end;
+    stats->rss_peak = r->peak;
+    stats->rss_util = r->peak ? (double)max_total_size / r->peak : 0;
+    stats->minflt = minor_faults() - r->minflt;
+}
+
+/*
+ * mt_results - replay copies of a trace on 1, 2, 4, ... up to nthreads
+ *     threads with mm and libc malloc, and print the aggregate throughput
+ *     and its speedup over one thread
+ */
+static void mt_results(trace_t *trace, char *tracefile, int nthreads,
+		       double remote_frac)
+{
+    int n, last;
+    double mm_kops, mm_base = 0, libc_kops, libc_base = 0;
+
+    printf("Multithreaded replay of %s, %.0f%% remote frees:\n",
+	   tracefile, remote_frac * 100.0);
+    printf("%7s %9s %6s %9s %6s\n",
+	   "threads", "mm Kops", "scale", "libc Kops", "scale");
+    for (n = 1, last = 0; !last; n = (2*n < nthreads) ? 2*n : nthreads) {
+	last = (n == nthreads);
+	mm_kops = n * trace->num_ops / 
+	    (mt_replay(trace, n, remote_frac, MT_MM) * 1e3);
+	libc_kops = n * trace->num_ops / 
+	    (mt_replay(trace, n, remote_frac, MT_LIBC) * 1e3);
+	if (n == 1) {
+	    mm_base = mm_kops;
+	    libc_base = libc_kops;
+	}
+	printf("%7d %9.0f %6.2f %9.0f %6.2f\n", n, 
+	       mm_kops, mm_kops / mm_base, libc_kops, libc_kops / libc_base);
+    }
+}
+
+/*
+ * check_persist - build a list in a new heap file at path, then detach
+ *     and attach again until it is empty, checking each time that
+ *     mm_get_root finds the same list. Every other node is freed before
+ *     each detach, and every node from the fourth detach on. Returns the
+ *     exit status.
+ */
+static int check_persist(char *path)
+{
+    typedef struct pnode {
+	struct pnode *next;
+	int value;
+    } pnode;
+    pnode *head = NULL, *p, **pp;
+    char *err = NULL;
+    int i, n, last, round;
+
+    if (access(path, F_OK) == 0) {
+	fprintf(stderr, "--persist: %s already exists\n", path);
+	return 1;
+    }
+    if (mm_attach(path) != 0) {
+	printf("--persist: mm_attach could not create %s: %s\n", 
+	       path, strerror(errno));
+	return 1;
+    }
+    if (mm_attach(path) != -1 || errno != EBUSY)
+	err = "a second mm_attach did not fail with EBUSY";
+
+    /* every fifth node is big enough to get a chunk of its own */
+    for (i = PERSIST_NODES - 1; i >= 0 && !err; i--) {
+	if ((p = mm_malloc(i % 5 ? sizeof(pnode) : 20000)) == NULL) {
+	    err = "mm_malloc failed";
+	    break;
+	}
+	p->value = i;
+	p->next = head;
+	head = p;
+    }
+    mm_set_root(head);
+    n = PERSIST_NODES;
+
+    for (round = 0; !err; round++) {
+	mm_detach();
+	if (mm_get_root() != NULL)
+	    err = "mm_get_root still set after mm_detach";
+	else if (mm_attach(path) != 1)
+	    err = "mm_attach did not pick the heap back up";
+	else if (mm_get_root() != head)
+	    err = "mm_get_root gave back a different root";
+	else {
+	    for (p = head, i = 0, last = -1; p && p->value > last; p = p->next) {
+		last = p->value;
+		i++;
+	    }
+	    if (p || i != n)
+		err = "the list came back different";
+	}
+	if (err || head == NULL)
+	    break;
+
+	for (pp = &head, i = 0; *pp; i++) {
+	    if (i % 2 || round >= 3) {
+		p = *pp;
+		*pp = p->next;
+		mm_free(p);
+		n--;
+	    } else
+		pp = &(*pp)->next;
+	}
+	mm_set_root(head);
+    }
+
+    mm_detach();
+    unlink(path);
+    if (err) {
+	printf("--persist: %s\n", err);
+	return 1;
+    }
+    printf("Persistent heap %s: root and list kept across %d reattaches\n",
+	   path, round + 1);
+    return 0;
+}
+
+/*
+ * load_backend - dlopen an allocator that exports mm_init, mm_malloc,
+ *     mm_free and optionally mm_realloc. RTLD_DEEPBIND makes its calls
+ *     to its own mm_ functions stay inside it instead of reaching mm.c.
+ */
+static void load_backend(allocator_t *a, char *path)
+{
+    void *lib;
+
+    if ((lib = dlopen(path, RTLD_NOW | RTLD_LOCAL | RTLD_DEEPBIND)) == NULL) {
+	printf("Could not load %s: %s\n", path, dlerror());
+	exit(1);
+    }
+    a->name = path;
+    a->init = (int (*)(void))dlsym(lib, "mm_init");
+    a->malloc = (void *(*)(size_t))dlsym(lib, "mm_malloc");
+    a->free = (void (*)(void *))dlsym(lib, "mm_free");
+    a->realloc = (void *(*)(void *, size_t))dlsym(lib, "mm_realloc");
+    if (a->init == NULL || a->malloc == NULL || a->free == NULL) {
+	printf("%s does not export mm_init, mm_malloc and mm_free\n", path);
+	exit(1);
+    }
+}
+
 /* 
  * app_error - Report an arbitrary application error
  */
@@ -1014,13 +3017,41 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvVaelLsS] [-f <file>] [-t <dir>] [-p <bytes>] [-j <n>]\n"
+	    "               [-T <threads> [-r <frac>]] [-b <lib.so>]...\n"
+	    "               [--json <file>] [--csv <file>]\n"
+	    "               [--baseline <file> [--tolerance <pct>] [--kops-tolerance <pct>]]\n"
+	    "               [--timeline[=<n>]] [--frag] [--touch[=all|lines|<n>] [--touch-check]]\n"
+	    "               [--rss] [--min-heap] [--cold] [--persist <file>]\n");
     fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-b <lib>   Also run an allocator .so exporting mm_init etc. (repeatable).\n");
+    fprintf(stderr, "\t-e         Count hardware events in the speed runs (with -v).\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-j <n>     Evaluate up to <n> (at least 2) traces at once in worker processes.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-L         Print per-request latency percentiles.\n");
+    fprintf(stderr, "\t-p <bytes> Sample one alloc per <bytes> into <trace>.heap.\n");
+    fprintf(stderr, "\t-r <frac>  With -T, free <frac> of blocks on another thread.\n");
+    fprintf(stderr, "\t-s         With -j, time the traces one at a time afterwards.\n");
+    fprintf(stderr, "\t-S         Stream traces from their files instead of loading them.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-T <n>     Replay on 1 up to <n> threads, mm and libc.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
+    fprintf(stderr, "\t--json <file>      Write the results as JSON.\n");
+    fprintf(stderr, "\t--csv <file>       Write the results as CSV.\n");
+    fprintf(stderr, "\t--baseline <file>  Exit with 2 if a trace regressed from these --csv results\n");
+    fprintf(stderr, "\t--tolerance <pct>  Allowed drop in util and util_i (default 5).\n");
+    fprintf(stderr, "\t--kops-tolerance <pct> Allowed drop in Kops, or twice its sd if more (default 20).\n");
+    fprintf(stderr, "\t--timeline[=<n>]   Write live/heap bytes per <n> requests to <trace>.timeline.csv.\n");
+    fprintf(stderr, "\t--frag             Break down where mm.c's heap went at its peak.\n");
+    fprintf(stderr, "\t--touch[=<what>]   Also time a replay writing and reading all of each\n"
+	    "\t                   payload, one word per cache line (lines) or <n> bytes.\n");
+    fprintf(stderr, "\t--touch-check      Check what --touch reads back.\n");
+    fprintf(stderr, "\t--rss              Report resident heap bytes and minor faults (with -v).\n");
+    fprintf(stderr, "\t--min-heap         Find the smallest heap cap each trace completes under.\n");
+    fprintf(stderr, "\t--cold             Also time each trace with the caches flushed before each run.\n");
+    fprintf(stderr, "\t--persist <file>   Check mm_attach/mm_detach with a new heap file instead.\n");
 }
@@ -1,11 +1,14 @@
 /*
  * memlib.c - bridge to mmap
  */
+#define _GNU_SOURCE /* for mremap */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 #include <string.h>
 #include <inttypes.h>
 #include <errno.h>
@@ -13,10 +16,57 @@
 #include "memlib.h"
 #include "pagemap.h"
 
+/*
+ * With MEM_NO_PAGEMAP (the LD_PRELOAD build, libmm.so) pages are only
+ * counted: nothing checks that they are mapped, and mem_reset cannot
+ * find them to unmap them.
+ */
+#ifdef MEM_NO_PAGEMAP
+#define pagemap_modify(p, mapped) ((void)0)
+#define pagemap_is_mapped(p) 1
+#define pagemap_for_each(f) ((void)(f))
+#define pagemap_visit(f) ((void)(f))
+#endif
+
 /* private variables */
 static int activity_counter = 0; /* to simulate other processes */
 
 static int page_count;
+static size_t heap_limit; /* most bytes mem_map may have out; 0 for no cap */
+
+/*
+ * File-backed heap. The first page of the file is a header; every
+ * chunk handed out by mem_map lives at heap base + its file offset, so
+ * pointers stored in the heap stay valid across processes as long as
+ * the file is always mapped at the same base address.
+ */
+#define MEM_FILE_MAGIC 0x31706165686d6dULL /* "mmheap1" */
+#define MEM_FILE_MAX_HOLES 128
+
+typedef struct {
+  uint64_t magic;
+  uint64_t base;      /* address the file must be mapped at */
+  uint64_t used;      /* bytes of the file handed out, header included */
+  uint64_t clean;     /* set by mem_close_file, cleared while attached */
+  uint64_t num_holes; /* unmapped extents below used, for reuse */
+  struct {
+    uint64_t off, len;
+  } holes[MEM_FILE_MAX_HOLES];
+  char root[MEM_FILE_ROOT_SIZE]; /* reserved for the allocator */
+} mem_file_header;
+
+static int heap_fd = -1;
+static mem_file_header *heap_hdr; /* NULL unless a file heap is open */
+static int heap_was_clean;
+
+static void *file_map(size_t sz);
+static void file_find_holes(uint64_t off, uint64_t end, uint64_t *prev,
+                            uint64_t *next);
+static void file_unmap(void *p, size_t sz);
+
+/* pages [run_lo, run_hi) seen by mem_resident but not yet counted */
+static char *run_lo, *run_hi;
+static size_t resident_pages;
 
 /* 
  * mem_init - initialize the memory system model
@@ -48,6 +98,16 @@ void mem_reset(void)
   pagemap_for_each(unmap);
   page_count = 0;
   activity_counter = 0;
+
+  if (heap_hdr) {
+    heap_hdr->used = APAGE_SIZE;
+    heap_hdr->num_holes = 0;
+    if (ftruncate(heap_fd, APAGE_SIZE) < 0) {
+      fprintf(stderr, "mem_reset: ftruncate failed: %s (%d)\n",
+              strerror(errno), errno);
+      abort();
+    }
+  }
 }
 
 /*
@@ -63,7 +123,85 @@ size_t mem_heapsize(void)
   return APAGE_SIZE * page_count;
 }
 
+/*
+ * mem_set_limit - cap mem_heapsize() at limit bytes, or lift the cap
+ *     with 0. Past the cap, mem_map and growing mem_remap return NULL.
+ *     The cap stays in place across mem_reset.
+ */
+void mem_set_limit(size_t limit)
+{
+  heap_limit = limit;
+}
+
+/*
+ * over_limit - would growing the heap by sz bytes pass the cap?
+ */
+static int over_limit(size_t sz)
+{
+  if (heap_limit && mem_heapsize() + sz > heap_limit) {
+    errno = ENOMEM;
+    return 1;
+  }
+  return 0;
+}
+
+/*
+ * count_run - add the resident pages among [run_lo, run_hi) to
+ *     resident_pages, asking mincore about up to 4096 pages at a time
+ */
+static void count_run(void)
+{
+  unsigned char vec[4096];
+  size_t n, i;
+
+  for (; run_lo < run_hi; run_lo += n * APAGE_SIZE) {
+    n = (run_hi - run_lo) / APAGE_SIZE;
+    if (n > sizeof(vec))
+      n = sizeof(vec);
+    if (mincore(run_lo, n * APAGE_SIZE, vec) < 0) {
+      fprintf(stderr, "mincore failed: %s (%d)\n",
+              strerror(errno), errno);
+      abort();
+    }
+    for (i = 0; i < n; i++)
+      resident_pages += vec[i] & 1;
+  }
+}
+
+/* pages are listed newest first, so runs mostly grow downwards */
+static void resident_page(void *p)
+{
+  char *c = p;
+
+  if (c + APAGE_SIZE == run_lo) {
+    run_lo = c;
+  } else if (c == run_hi) {
+    run_hi += APAGE_SIZE;
+  } else {
+    count_run();
+    run_lo = c;
+    run_hi = c + APAGE_SIZE;
+  }
+}
+
+/*
+ * mem_resident - bytes of the mapped heap pages that are resident in
+ *     memory, i.e. that have been touched and not given back since.
+ *     Always 0 with MEM_NO_PAGEMAP.
+ */
+size_t mem_resident(void)
+{
+  resident_pages = 0;
+  run_lo = run_hi = NULL;
+  pagemap_visit(resident_page);
+  count_run();
+  return resident_pages * APAGE_SIZE;
+}
 
+/*
+ * mem_map - map sz bytes of new pages. Returns NULL, with errno set, if
+ *     that would pass the mem_set_limit cap or the kernel refuses.
+ */
 void *mem_map(size_t sz)
 {
   void *p;
@@ -75,18 +213,22 @@ void *mem_map(size_t sz)
     abort();
   }
 
-  activity_counter++;
-  if ((activity_counter & (activity_counter - 1)) == 0) {
-    /* allocate a page to ensure that mem_map results are not
-       always sequential */
-    mmap(0, APAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
-  }
+  if (over_limit(sz))
+    return NULL;
 
-  p = mmap(0, sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
-  if (p == MAP_FAILED) {
-    fprintf(stderr, "mmap failed: %s (%d)\n",
-            strerror(errno), errno);
-    abort();
+  if (heap_hdr) {
+    p = file_map(sz);
+  } else {
+    activity_counter++;
+    if ((activity_counter & (activity_counter - 1)) == 0) {
+      /* allocate a page to ensure that mem_map results are not
+         always sequential */
+      mmap(0, APAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    }
+
+    p = mmap(0, sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    if (p == MAP_FAILED)
+      return NULL;
   }
 
   for (i = 0; i < sz; i += APAGE_SIZE) {
@@ -113,6 +255,20 @@ void mem_unmap(void *p, size_t sz)
     abort();
   }
   
+  if (heap_hdr) {
+    uint64_t off = (uintptr_t)p - heap_hdr->base, prev, next;
+
+    /* check before anything is unmapped that the extent can be kept */
+    file_find_holes(off, off + sz, &prev, &next);
+    if (prev == heap_hdr->num_holes && next == heap_hdr->num_holes &&
+        off + sz != heap_hdr->used &&
+        heap_hdr->num_holes == MEM_FILE_MAX_HOLES) {
+      fprintf(stderr, "mem_unmap: heap file already has %d separate holes\n",
+              MEM_FILE_MAX_HOLES);
+      abort();
+    }
+  }
+
   for (i = 0; i < sz; i += APAGE_SIZE) {
     if (!pagemap_is_mapped(p+i)) {
       fprintf(stderr, "mem_unmap: given page is not mapped: %p (in %p:%p)\n",
@@ -130,4 +286,307 @@ void mem_unmap(void *p, size_t sz)
             strerror(errno), errno);
     abort();
   }
+
+  if (heap_hdr)
+    file_unmap(p, sz);
+}
+
+/*
+ * mem_remap - resize the mapping of old_sz bytes at p to new_sz bytes,
+ *     letting the kernel move it if it cannot grow in place. The pages
+ *     are moved by the kernel, so the contents are not copied.
+ *     Returns the (possibly new) address of the mapping, or NULL with the
+ *     old mapping left as it was if growing it would pass the cap.
+ */
+void *mem_remap(void *p, size_t old_sz, size_t new_sz)
+{
+  void *q;
+  size_t i;
+
+  if (((uintptr_t)p) & (APAGE_SIZE - 1)) {
+    fprintf(stderr, "mem_remap: given address is not page-aligned: %p\n",
+            p);
+    abort();
+  }
+
+  if ((old_sz & (APAGE_SIZE - 1)) || (new_sz & (APAGE_SIZE - 1))) {
+    fprintf(stderr, "mem_remap: given sizes are not multiples of %d: %ld %ld\n",
+            APAGE_SIZE, old_sz, new_sz);
+    abort();
+  }
+
+  for (i = 0; i < old_sz; i += APAGE_SIZE) {
+    if (!pagemap_is_mapped(p+i)) {
+      fprintf(stderr, "mem_remap: given page is not mapped: %p (in %p:%p)\n",
+              p + i, p, p + old_sz);
+      abort();
+    }
+  }
+
+  if (new_sz > old_sz && over_limit(new_sz - old_sz))
+    return NULL;
+
+  if (heap_hdr) {
+    /* a moved shared mapping would no longer sit at base + offset,
+       so the file heap has to copy */
+    if ((q = mem_map(new_sz)) == NULL)
+      return NULL;
+    memcpy(q, p, old_sz < new_sz ? old_sz : new_sz);
+    mem_unmap(p, old_sz);
+    return q;
+  }
+
+  q = mremap(p, old_sz, new_sz, MREMAP_MAYMOVE);
+  if (q == MAP_FAILED)
+    return NULL;
+
+  if (q == p) {
+    /* resized in place: only the pages past the shorter end change */
+    for (i = new_sz; i < old_sz; i += APAGE_SIZE) {
+      pagemap_modify(p + i, 0);
+      --page_count;
+    }
+    for (i = old_sz; i < new_sz; i += APAGE_SIZE) {
+      pagemap_modify(q + i, 1);
+      page_count++;
+    }
+  } else {
+    for (i = 0; i < old_sz; i += APAGE_SIZE) {
+      pagemap_modify(p + i, 0);
+      --page_count;
+    }
+    for (i = 0; i < new_sz; i += APAGE_SIZE) {
+      pagemap_modify(q + i, 1);
+      page_count++;
+    }
+  }
+
+  return q;
+}
+
+/*
+ * mem_open_file - back the heap with the file at path, mapped at base.
+ *     An existing heap file is mapped back in at the same address with
+ *     all of its chunks; otherwise an empty heap file is created.
+ *     Returns 1 if an existing heap was attached, 0 if a new one was
+ *     created, -1 on error (errno is set, to EBUSY if a heap file is
+ *     already open).
+ */
+int mem_open_file(const char *path, void *base)
+{
+  mem_file_header hdr;
+  void *p;
+  uint64_t off, end, i;
+  ssize_t n;
+  int fd, existing;
+
+  if (heap_hdr) {
+    errno = EBUSY;
+    return -1;
+  }
+
+  if ((fd = open(path, O_RDWR | O_CREAT, 0600)) < 0)
+    return -1;
+
+  n = pread(fd, &hdr, sizeof(hdr), 0);
+  existing = (n == sizeof(hdr) && hdr.magic == MEM_FILE_MAGIC);
+  if (existing && hdr.base != (uintptr_t)base) {
+    close(fd);
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (!existing && ftruncate(fd, APAGE_SIZE) < 0) {
+    close(fd);
+    return -1;
+  }
+
+  p = mmap(base, APAGE_SIZE, PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_FIXED_NOREPLACE, fd, 0);
+  if (p == MAP_FAILED || p != base) {
+    if (p != MAP_FAILED)
+      munmap(p, APAGE_SIZE);
+    close(fd);
+    errno = EADDRINUSE;
+    return -1;
+  }
+
+  heap_fd = fd;
+  heap_hdr = p;
+
+  if (!existing) {
+    memset(heap_hdr, 0, sizeof(*heap_hdr));
+    heap_hdr->magic = MEM_FILE_MAGIC;
+    heap_hdr->base = (uintptr_t)base;
+    heap_hdr->used = APAGE_SIZE;
+    heap_was_clean = 1;
+  } else {
+    /* map every chunk back in, skipping the extents that were unmapped */
+    heap_was_clean = (int)heap_hdr->clean;
+    for (off = APAGE_SIZE; off < heap_hdr->used; off = end) {
+      end = heap_hdr->used;
+      for (i = 0; i < heap_hdr->num_holes; i++) {
+        if (heap_hdr->holes[i].off == off)
+          break;
+        if (heap_hdr->holes[i].off > off && heap_hdr->holes[i].off < end)
+          end = heap_hdr->holes[i].off;
+      }
+      if (i < heap_hdr->num_holes) {
+        end = off + heap_hdr->holes[i].len;
+        continue;
+      }
+      p = mmap((char *)base + off, end - off, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_FIXED_NOREPLACE, fd, off);
+      if (p != (char *)base + off) {
+        fprintf(stderr, "mem_open_file: cannot map heap at %p: %s (%d)\n",
+                (char *)base + off, strerror(errno), errno);
+        abort();
+      }
+      for (i = 0; i < end - off; i += APAGE_SIZE) {
+        pagemap_modify((char *)p + i, 1);
+        page_count++;
+      }
+    }
+  }
+
+  heap_hdr->clean = 0;
+  msync(heap_hdr, APAGE_SIZE, MS_SYNC);
+  return existing;
+}
+
+/*
+ * mem_close_file - flush the file heap, mark it cleanly shut down and
+ *     unmap it.
+ */
+void mem_close_file(void)
+{
+  if (!heap_hdr)
+    return;
+
+  pagemap_for_each(unmap);
+  page_count = 0;
+
+  heap_hdr->clean = 1;
+  msync(heap_hdr, APAGE_SIZE, MS_SYNC);
+  fsync(heap_fd);
+  munmap(heap_hdr, APAGE_SIZE);
+  close(heap_fd);
+  heap_hdr = NULL;
+  heap_fd = -1;
+}
+
+/*
+ * mem_file_clean - whether the attached heap file was closed with
+ *     mem_close_file the last time it was used
+ */
+int mem_file_clean(void)
+{
+  return heap_was_clean;
+}
+
+/*
+ * mem_file_root - MEM_FILE_ROOT_SIZE bytes in the header page that the
+ *     allocator can use for its own state; NULL without a file heap
+ */
+void *mem_file_root(void)
+{
+  return heap_hdr ? heap_hdr->root : NULL;
+}
+
+/*
+ * file_map - hand out sz bytes of the heap file, reusing an unmapped
+ *     extent when one is big enough and growing the file otherwise
+ */
+static void *file_map(size_t sz)
+{
+  uint64_t off, i;
+  void *p;
+
+  for (i = 0; i < heap_hdr->num_holes; i++)
+    if (heap_hdr->holes[i].len >= sz)
+      break;
+
+  if (i < heap_hdr->num_holes) {
+    off = heap_hdr->holes[i].off;
+    heap_hdr->holes[i].off += sz;
+    heap_hdr->holes[i].len -= sz;
+    if (heap_hdr->holes[i].len == 0)
+      heap_hdr->holes[i] = heap_hdr->holes[--heap_hdr->num_holes];
+  } else {
+    off = heap_hdr->used;
+    if (ftruncate(heap_fd, off + sz) < 0) {
+      fprintf(stderr, "mem_map: cannot grow heap file: %s (%d)\n",
+              strerror(errno), errno);
+      abort();
+    }
+    heap_hdr->used = off + sz;
+  }
+
+  p = mmap((char *)(uintptr_t)heap_hdr->base + off, sz,
+           PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED_NOREPLACE,
+           heap_fd, off);
+  if (p != (char *)(uintptr_t)heap_hdr->base + off) {
+    fprintf(stderr, "mem_map: cannot map heap file at offset %" PRIu64
+            ": %s (%d)\n", off, strerror(errno), errno);
+    abort();
+  }
+
+  return p;
+}
+
+/*
+ * file_find_holes - set *prev to the hole ending at off and *next to the
+ *     one starting at end, each num_holes if there is none
+ */
+static void file_find_holes(uint64_t off, uint64_t end, uint64_t *prev,
+                            uint64_t *next)
+{
+  uint64_t i;
+
+  *prev = *next = heap_hdr->num_holes;
+  for (i = 0; i < heap_hdr->num_holes; i++) {
+    if (heap_hdr->holes[i].off + heap_hdr->holes[i].len == off)
+      *prev = i;
+    if (heap_hdr->holes[i].off == end)
+      *next = i;
+  }
+}
+
+/*
+ * file_unmap - release the file storage behind an unmapped extent and
+ *     remember the extent for reuse, merged with the holes on either
+ *     side. An extent that reaches the end of the heap shrinks the file
+ *     instead. mem_unmap has already checked that the hole table has
+ *     room for it.
+ */
+static void file_unmap(void *p, size_t sz)
+{
+  uint64_t off = (uintptr_t)p - heap_hdr->base;
+  uint64_t end = off + sz;
+  uint64_t prev, next;
+
+  fallocate(heap_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, off, sz);
+
+  /* take the neighbours out of the table, the later slot first, since
+     removing a slot moves the last one into it */
+  file_find_holes(off, end, &prev, &next);
+  if (next < heap_hdr->num_holes)
+    end += heap_hdr->holes[next].len;
+  if (prev < heap_hdr->num_holes)
+    off = heap_hdr->holes[prev].off;
+  if (next < heap_hdr->num_holes && next > prev)
+    heap_hdr->holes[next] = heap_hdr->holes[--heap_hdr->num_holes];
+  if (prev < heap_hdr->num_holes)
+    heap_hdr->holes[prev] = heap_hdr->holes[--heap_hdr->num_holes];
+  if (next < heap_hdr->num_holes && next < prev)
+    heap_hdr->holes[next] = heap_hdr->holes[--heap_hdr->num_holes];
+
+  if (end == heap_hdr->used && ftruncate(heap_fd, off) == 0) {
+    heap_hdr->used = off;
+    return;
+  }
+
+  heap_hdr->holes[heap_hdr->num_holes].off = off;
+  heap_hdr->holes[heap_hdr->num_holes].len = end - off;
+  heap_hdr->num_holes++;
 }
@@ -6,5 +6,16 @@ void mem_reset(void);
 size_t mem_pagesize(void);
 void *mem_map(size_t);
 void mem_unmap(void *, size_t);
+void *mem_remap(void *, size_t, size_t);
 
 size_t mem_heapsize(void);
+void mem_set_limit(size_t);
+size_t mem_resident(void);
+
+/* file-backed heap that survives the process */
+#define MEM_FILE_ROOT_SIZE 1024
+
+int mem_open_file(const char *path, void *base);
+void mem_close_file(void);
+int mem_file_clean(void);
+void *mem_file_root(void);
@@ -13,6 +13,12 @@
 #include <assert.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <limits.h>
+#include <math.h>
+#include <execinfo.h>
+#include <sys/mman.h>
 
 #include "mm.h"
 #include "memlib.h"
@@ -68,16 +74,88 @@ typedef struct {
 /* rounds up to the nearest multiple of mem_pagesize() */
 #define PAGE_ALIGN(size) (((size) + (mem_pagesize()-1)) & ~(mem_pagesize()-1))
 
+//blocks at least this big get a chunk of their own, so realloc can grow them with mem_remap
+//and free can hand the chunk straight back with mem_unmap.
+#define LARGE_THRESHOLD (16*1024)
+//header/footer bit marking a block that owns its whole chunk.
+#define LARGE 0x2
+#define IS_LARGE(p) (GET(p) & LARGE)
+//header bit marking a block the heap profiler is tracking.
+#define SAMPLED 0x4
+#define IS_SAMPLED(p) (GET(p) & SAMPLED)
+
+//every chunk starts with its size and links to the other chunks so the whole heap can be walked:
+//  0: next chunk, 8: prev chunk, 16: chunk size, 32: prolog, 40: first block header ... end-8: terminator
+//the block area is the chunk size minus CHUNK_OVERHEAD, so it stays a multiple of 16.
+typedef struct chunk {
+  struct chunk* next;
+  struct chunk* prev;
+  size_t size;
+  size_t unused;
+} chunk;
+#define CHUNK_OVERHEAD 48
+#define CHUNK_FIRST_HDRP(c) ((char *)(c) + 40)
+#define CHUNK_TERMINATOR(c) ((char *)(c) + (c)->size - 8)
+// A large block realigned by mm_memalign has an allocated padding block in front of it
+#define HAS_PADDING(bp) (GET_SIZE(HDRP(bp) - 8) != 0)
+// Given the payload of a large block, get its chunk
+#define LARGE_CHUNKP(bp) ((chunk *)(HDRP(bp) - GET_SIZE(HDRP(bp) - 8) - 40))
+
+//smallest block that can go on the free list: tags plus the list node.
+#define MIN_BLOCK 32
+
+//biggest request we take: leaves room for the tags, rounding, chunk header and page
+//alignment (or memalign's slack) without the size math wrapping around.
+#define MAX_REQUEST ((size_t)PTRDIFF_MAX - (1 << 20))
+
+#define MIN(x, y) ((x) < (y) ? (x) : (y))
+#define MAX(x, y) ((x) > (y) ? (x) : (y))
+
+//where a persistent heap file is mapped; every process attaching the file must use the same address.
+#define MM_HEAP_BASE ((void*)0x5a0000000000)
+
 void* initializeNewPage(size_t size);
 void* allocateBlock(void* ptr, size_t size);
 void addNodeToFreeList(void* ptr);
 void* findFreeBlockAndRemoveFromFreeList(size_t size);
 static void* coalesce(void *bp);
-void addRemainingSpaceAsFree(void* ptr, int size);
+void addRemainingSpaceAsFree(void* ptr, size_t size);
+static void* mallocLarge(size_t newsize);
+static void* initLargeChunk(chunk* c, size_t chunkSize);
+static void* mapChunk(size_t chunkSize);
+static void linkChunk(chunk* c);
+static void unlinkChunk(chunk* c);
+static int sizeClass(size_t size);
+static void* mallocBlock(size_t size);
+static void* useFreeBlock(void* p, size_t size);
+static void* findBestFitAndRemoveFromFreeList(size_t size);
+static void reclaimFreeSpace(void);
+static void* mallocSampled(size_t size, void* caller) __attribute__((noinline));
+static void freeSampled(void* ptr);
+static void moveSample(void* from, void* to);
+static void dropLiveSamples(void);
 
 void *current_avail = NULL;
-int remainingPageSize = 0;
+size_t remainingPageSize = 0;
 node* pLastFree= NULL;
+void* pRoot = NULL;
+chunk* pChunks = NULL;
+
+//counters behind mm_stats, kept up to date on every operation.
+struct mm_stats stats;
+//false once the block stats.largest_free described has been taken off the free list.
+int largestFreeKnown = 1;
+
+//allocator state saved in the heap file's header page by mm_detach.
+typedef struct {
+  void* root;
+  void* current_avail;
+  size_t remainingPageSize;
+  node* pLastFree;
+  chunk* pChunks;
+  struct mm_stats stats;
+  int largestFreeKnown;
+} persistent_state;
 
 /* 
  * mm_init - initialize the malloc package.
@@ -87,52 +165,150 @@ int mm_init(void)
   pLastFree = NULL;
   current_avail = NULL;
   remainingPageSize = 0;
+  pRoot = NULL;
+  pChunks = NULL;
+  memset(&stats, 0, sizeof(stats));
+  largestFreeKnown = 1;
+  dropLiveSamples();
   return 0;
 }
 
+/*
+ * mm_attach - use the heap file at path, creating it if needed. Returns 1 if
+ *     the heap from the last run was picked up (mm_get_root gives back its
+ *     root), 0 if the heap starts out empty, -1 if the file cannot be mapped.
+ */
+int mm_attach(const char *path)
+{
+  int existing = mem_open_file(path, MM_HEAP_BASE);
+  persistent_state* state;
+
+  if(existing < 0){
+    return -1;
+  }
+
+  state = mem_file_root();
+  if(existing && mem_file_clean()){
+    pRoot = state->root;
+    current_avail = state->current_avail;
+    remainingPageSize = state->remainingPageSize;
+    pLastFree = state->pLastFree;
+    pChunks = state->pChunks;
+    stats = state->stats;
+    largestFreeKnown = state->largestFreeKnown;
+    return 1;
+  }
+
+  //new file, or the last process died mid-update and the free list can't be trusted: start over.
+  mem_reset();
+  return mm_init();
+}
+
+/*
+ * mm_detach - save the allocator state to the heap file and close it cleanly.
+ */
+void mm_detach(void)
+{
+  persistent_state* state = mem_file_root();
+
+  if(state == NULL){
+    return;
+  }
+
+  state->root = pRoot;
+  state->current_avail = current_avail;
+  state->remainingPageSize = remainingPageSize;
+  state->pLastFree = pLastFree;
+  state->pChunks = pChunks;
+  state->stats = stats;
+  state->largestFreeKnown = largestFreeKnown;
+  mem_close_file();
+  mm_init();
+}
+
+/*
+ * mm_set_root/mm_get_root - the one pointer a program needs to find its data
+ *     structures again after attaching a persistent heap.
+ */
+void mm_set_root(void *ptr)
+{
+  pRoot = ptr;
+}
+
+void *mm_get_root(void)
+{
+  return pRoot;
+}
+
+//bytes left until the next sampled allocation; with the profiler off it never runs out.
+long sampleCountdown = LONG_MAX;
+
 /* 
- * mm_malloc - Allocate a block by using bytes from current_avail,
- *     grabbing a new page if necessary.
+ * mm_malloc - Allocate a block, handing every so often one to the heap profiler.
  */
 void *mm_malloc(size_t size)
+{
+  if(size > MAX_REQUEST){
+    errno = ENOMEM;
+    return NULL;
+  }
+  //the profiler costs the fast path one subtraction and one branch.
+  if((sampleCountdown -= (long)size) < 0){
+    return mallocSampled(size, __builtin_return_address(0));
+  }
+  return mallocBlock(size);
+}
+
+/* 
+ * mallocBlock - Allocate a block by using bytes from current_avail,
+ *     grabbing a new page if necessary.
+ */
+static void* mallocBlock(size_t size)
 {
 
-  int newsize = ALIGN(size + OVERHEAD);
+  size_t newsize = ALIGN(size + OVERHEAD);
+  size_t chunkSize;
   void *p;
+
+  if(newsize < MIN_BLOCK){
+    newsize = MIN_BLOCK;
+  }
+
+  if(newsize >= LARGE_THRESHOLD){
+    return mallocLarge(newsize);
+  }
   
   p = findFreeBlockAndRemoveFromFreeList(newsize);
   if(p != NULL){
-    //change the block to allocated
-    PUT(HDRP(p), PACK(GET_SIZE(HDRP(p)), 1));
-    PUT(FTRP(p), PACK(GET_SIZE(HDRP(p)), 1));
-    return p;
+    return useFreeBlock(p, GET_SIZE(HDRP(p)));
   }
 
   if (remainingPageSize < newsize) {
     
     if(remainingPageSize!= 0){
       addRemainingSpaceAsFree(current_avail, remainingPageSize);
+      remainingPageSize = 0;
     }
 
     //doing some preliminary testing before implementing anything I found 32 this to be the optimal size to call memMap with.
-    remainingPageSize = PAGE_ALIGN((newsize*32)+24);
+    chunkSize = PAGE_ALIGN((newsize*32)+CHUNK_OVERHEAD);
     //int pageSize = 45056;
      //pageSize  = pageSize< newsize ? 524288 : 65536;
     //remainingPageSize = PAGE_ALIGN(pageSize);
-    current_avail = mem_map(remainingPageSize);
-
-    block_footer* prolog = current_avail;
-    PUT(prolog, PACK(0,1));
-    block_header* terminator = current_avail + remainingPageSize -16;
-    PUT(terminator, PACK(0,1));
-    block_footer* terminatorWithPageSize = current_avail + remainingPageSize-8;
-    PUT(terminatorWithPageSize, PACK(remainingPageSize, 1));
-
-    remainingPageSize -=24;
-    current_avail +=8;
+    current_avail = mapChunk(chunkSize);
 
-    if (current_avail == NULL)
-      return NULL;
+    if (current_avail == NULL){
+      //at the memory cap: make do with what is already mapped, then with a chunk that just fits.
+      reclaimFreeSpace();
+      if((p = findBestFitAndRemoveFromFreeList(newsize)) != NULL){
+        return useFreeBlock(p, newsize);
+      }
+      chunkSize = PAGE_ALIGN(newsize + CHUNK_OVERHEAD);
+      if((current_avail = mapChunk(chunkSize)) == NULL){
+        return NULL;
+      }
+    }
+    remainingPageSize = chunkSize - CHUNK_OVERHEAD;
   }
 
   //adjust remaining size.
@@ -152,6 +328,8 @@ void *mm_malloc(size_t size)
   p = current_avail+8;
 
   current_avail += newsize;
+  stats.live_bytes += newsize;
+  stats.live_blocks++;
   
   return p;
 }
@@ -171,6 +349,28 @@ void mm_free(void *ptr)
   // }
 
   size_t size = GET_SIZE(HDRP(ptr));
+
+  if(IS_SAMPLED(HDRP(ptr))){
+    freeSampled(ptr);
+  }
+
+  stats.live_bytes -= size;
+  stats.live_blocks--;
+
+  //a large block is the only thing in its chunk, so the chunk goes straight back.
+  if(IS_LARGE(HDRP(ptr))){
+    chunk* c = LARGE_CHUNKP(ptr);
+    if(HAS_PADDING(ptr)){
+      stats.live_bytes -= GET_SIZE(HDRP(ptr) - 8);
+      stats.live_blocks--;
+    }
+    unlinkChunk(c);
+    stats.mapped_bytes -= c->size;
+    stats.chunks--;
+    mem_unmap(c, c->size);
+    return;
+  }
+
   PUT(HDRP(ptr), PACK(size, 0));
   PUT(FTRP(ptr), PACK(size, 0));
  // printf("done packing header and footer.\n");
@@ -178,7 +378,663 @@ void mm_free(void *ptr)
  // printf("done adding node to free list\n");
 }
 
+/*
+ * mm_realloc - Resize a block. Large blocks are resized by remapping their
+ *     chunk, so the kernel moves the pages instead of us copying the bytes.
+ *     A small block that is the last one carved from the current chunk grows
+ *     into the unused tail; anything else is malloc + copy + free.
+ */
+void *mm_realloc(void *ptr, size_t size)
+{
+  if(ptr == NULL){
+    return mm_malloc(size);
+  }
+  if(size == 0){
+    mm_free(ptr);
+    return NULL;
+  }
+  //too big to grow into, so the block stays as it is.
+  if(size > MAX_REQUEST){
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  size_t newsize = ALIGN(size + OVERHEAD);
+  size_t oldsize = GET_SIZE(HDRP(ptr));
+  void *newp;
+
+  if(IS_LARGE(HDRP(ptr)) && !HAS_PADDING(ptr) && newsize >= LARGE_THRESHOLD){
+    size_t oldChunkSize = LARGE_CHUNKP(ptr)->size;
+    size_t chunkSize = PAGE_ALIGN(newsize + CHUNK_OVERHEAD);
+    if(chunkSize == oldChunkSize){
+      return ptr;
+    }
+    size_t sampled = IS_SAMPLED(HDRP(ptr));
+    chunk* c = mem_remap(LARGE_CHUNKP(ptr), oldChunkSize, chunkSize);
+    //at the memory cap the chunk can't grow, but the block may still fit in free space below.
+    if(c != NULL){
+      //the chunk may have moved, so its neighbours need to point at the new address.
+      if(c->prev != NULL){
+        c->prev->next = c;
+      } else {
+        pChunks = c;
+      }
+      if(c->next != NULL){
+        c->next->prev = c;
+      }
+      stats.mapped_bytes += chunkSize - oldChunkSize;
+      stats.live_bytes += chunkSize - oldChunkSize;
+      newp = initLargeChunk(c, chunkSize);
+      if(sampled){
+        PUT(HDRP(newp), GET(HDRP(newp)) | SAMPLED);
+        PUT(FTRP(newp), GET(FTRP(newp)) | SAMPLED);
+        moveSample(ptr, newp);
+      }
+      return newp;
+    }
+  }
+
+  if(!IS_LARGE(HDRP(ptr))){
+    if(newsize <= oldsize){
+      return ptr;
+    }
+
+    //the block ends where the bump pointer starts, so just take more of the tail.
+    if(HDRP(ptr) + oldsize == current_avail && newsize < LARGE_THRESHOLD
+       && remainingPageSize >= newsize - oldsize){
+      remainingPageSize -= newsize - oldsize;
+      current_avail += newsize - oldsize;
+      if(remainingPageSize < 32){
+        newsize += remainingPageSize;
+        current_avail += remainingPageSize;
+        remainingPageSize = 0;
+      }
+      PUT(HDRP(ptr), PACK(newsize, 1 | IS_SAMPLED(HDRP(ptr))));
+      PUT(FTRP(ptr), GET(HDRP(ptr)));
+      stats.live_bytes += newsize - oldsize;
+      return ptr;
+    }
+  }
+
+  if((newp = mm_malloc(size)) == NULL){
+    return NULL;
+  }
+  memcpy(newp, ptr, MIN(size, oldsize - OVERHEAD));
+  mm_free(ptr);
+  return newp;
+}
+
+/*
+ * mm_memalign - Allocate a block whose payload is a multiple of alignment (a power of
+ *     two). Over-allocates, then gives back the space in front of the aligned payload:
+ *     as a free block for a small block, as an allocated padding block that goes away
+ *     with the chunk for a large one. A small block's unneeded end is split off too.
+ */
+void *mm_memalign(size_t alignment, size_t size)
+{
+  char *p, *q;
+  size_t blockSize, front, newsize;
+  long flags;
+
+  if(alignment <= ALIGNMENT){
+    return mm_malloc(size);
+  }
+  if(alignment > MAX_REQUEST || size > MAX_REQUEST - alignment - MIN_BLOCK){
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  if((p = mm_malloc(size + alignment + MIN_BLOCK)) == NULL){
+    return NULL;
+  }
+
+  q = (char*)(((uintptr_t)p + alignment - 1) & ~(uintptr_t)(alignment - 1));
+  if(q != p && q - p < MIN_BLOCK){
+    q += alignment;
+  }
+  if(q == p){
+    return p;
+  }
+
+  front = q - p;
+  blockSize = GET_SIZE(HDRP(p));
+  flags = GET(HDRP(p)) & (LARGE | SAMPLED);
+
+  PUT(HDRP(q), PACK(blockSize - front, 1 | flags));
+  PUT(FTRP(q), GET(HDRP(q)));
+  if(flags & SAMPLED){
+    moveSample(p, q);
+  }
+
+  if(flags & LARGE){
+    PUT(HDRP(p), PACK(front, 1));
+    PUT(FTRP(p), PACK(front, 1));
+    stats.live_blocks++;
+    return q;
+  }
+
+  PUT(HDRP(p), PACK(front, 0));
+  PUT(FTRP(p), PACK(front, 0));
+  stats.live_bytes -= front;
+  addNodeToFreeList(p);
+
+  newsize = MAX(ALIGN(size + OVERHEAD), MIN_BLOCK);
+  if(blockSize - front - newsize >= MIN_BLOCK){
+    char* back = q + newsize;
+    PUT(HDRP(q), PACK(newsize, 1 | flags));
+    PUT(FTRP(q), GET(HDRP(q)));
+    PUT(HDRP(back), PACK(blockSize - front - newsize, 0));
+    PUT(FTRP(back), PACK(blockSize - front - newsize, 0));
+    stats.live_bytes -= blockSize - front - newsize;
+    addNodeToFreeList(back);
+  }
+
+  return q;
+}
+
+/*
+ * mm_usable_size - how many bytes the caller can actually use at ptr.
+ */
+size_t mm_usable_size(void *ptr)
+{
+  return GET_SIZE(HDRP(ptr)) - OVERHEAD;
+}
+
+/*
+ * useFreeBlock - allocate a block taken off the free list, splitting off what is past
+ *     the first size bytes as a new free block if it is big enough to be one.
+ */
+static void* useFreeBlock(void* p, size_t size){
+  size_t blockSize = GET_SIZE(HDRP(p));
+
+  if(blockSize - size >= MIN_BLOCK){
+    char* rest = (char*)p + size;
+    PUT(HDRP(rest), PACK(blockSize - size, 0));
+    PUT(FTRP(rest), PACK(blockSize - size, 0));
+    addNodeToFreeList(rest);
+    blockSize = size;
+  }
+  PUT(HDRP(p), PACK(blockSize, 1));
+  PUT(FTRP(p), PACK(blockSize, 1));
+  stats.live_bytes += blockSize;
+  stats.live_blocks++;
+  return p;
+}
+
+/*
+ * mallocLarge - map a chunk holding exactly one block of at least newsize bytes.
+ */
+static void* mallocLarge(size_t newsize){
+  size_t chunkSize = PAGE_ALIGN(newsize + CHUNK_OVERHEAD);
+  char* firstHeader = mapChunk(chunkSize);
+  void* p;
+
+  if(firstHeader == NULL){
+    //at the memory cap: hand back the chunks that are all free and retry, or take a
+    //free block big enough; as an ordinary block it goes back on the free list when freed.
+    reclaimFreeSpace();
+    if((firstHeader = mapChunk(chunkSize)) == NULL){
+      p = findBestFitAndRemoveFromFreeList(newsize);
+      return p == NULL ? NULL : useFreeBlock(p, newsize);
+    }
+  }
+
+  stats.live_bytes += chunkSize - CHUNK_OVERHEAD;
+  stats.live_blocks++;
+  return initLargeChunk((chunk*)(firstHeader - 40), chunkSize);
+}
+
+/*
+ * initLargeChunk - turn the whole block area of a chunk into one large block,
+ *   returns the payload pointer. Also used after a remap, where the payload is
+ *   already in place and only the tags past it need rewriting.
+ */
+static void* initLargeChunk(chunk* c, size_t chunkSize){
+  size_t blockSize = chunkSize - CHUNK_OVERHEAD;
+  void* bp = CHUNK_FIRST_HDRP(c) + 8;
+
+  c->size = chunkSize;
+  PUT(HDRP(bp), PACK(blockSize, 1|LARGE));
+  PUT(FTRP(bp), PACK(blockSize, 1|LARGE));
+  PUT(CHUNK_TERMINATOR(c), PACK(0,1));
+
+  return bp;
+}
+
+/*
+ * mapChunk - map a new chunk, link it into the chunk list and put down its prolog,
+ *   terminator and size. Returns where the first block header goes.
+ */
+static void* mapChunk(size_t chunkSize){
+  chunk* c = mem_map(chunkSize);
+
+  if(c == NULL){
+    return NULL;
+  }
+
+  linkChunk(c);
+  c->size = chunkSize;
+  PUT(CHUNK_FIRST_HDRP(c) - 8, PACK(0,1));
+  PUT(CHUNK_TERMINATOR(c), PACK(0,1));
+
+  stats.mapped_bytes += chunkSize;
+  stats.chunks++;
+  return CHUNK_FIRST_HDRP(c);
+}
+
+static void linkChunk(chunk* c){
+  c->prev = NULL;
+  c->next = pChunks;
+  if(pChunks != NULL){
+    pChunks->prev = c;
+  }
+  pChunks = c;
+}
+
+static void unlinkChunk(chunk* c){
+  if(c->prev != NULL){
+    c->prev->next = c->next;
+  } else {
+    pChunks = c->next;
+  }
+  if(c->next != NULL){
+    c->next->prev = c->prev;
+  }
+}
+
+/*
+ * sizeClass - index of the power-of-two class a free block of this size is counted in.
+ */
+static int sizeClass(size_t size){
+  int class = 0;
+
+  for(size >>= 6; size != 0 && class < MM_SIZE_CLASSES-1; size >>= 1){
+    class++;
+  }
+  return class;
+}
+
+/*
+ * mm_stats - copy out the heap statistics. Everything is kept as running counters,
+ *     so this is O(1) and never touches the heap itself.
+ */
+void mm_stats(struct mm_stats *out)
+{
+  size_t freeSpace;
+  int class;
+
+  *out = stats;
+  out->tail_bytes = remainingPageSize;
+
+  //the previous largest block was reused since; the best we know without a walk is
+  //the bottom of the highest class that still has free bytes.
+  if(!largestFreeKnown){
+    out->largest_free = 0;
+    for(class = MM_SIZE_CLASSES-1; class >= 0; class--){
+      if(stats.free_class_bytes[class] != 0){
+        out->largest_free = (size_t)32 << class;
+        break;
+      }
+    }
+  }
+  if(out->tail_bytes > out->largest_free){
+    out->largest_free = out->tail_bytes;
+  }
+
+  freeSpace = out->free_bytes + out->tail_bytes;
+  out->frag_index = freeSpace ? 1.0 - (double)out->largest_free / freeSpace : 0.0;
+}
+
+/*
+ * mm_walk - call f on every chunk, and on every block in it in address order, by
+ *     following the header tags from each chunk's prolog to its terminator.
+ *     Since it sees every free block, it also pins down the largest one for mm_stats.
+ */
+void mm_walk(mm_walk_callback f, void *arg)
+{
+  chunk* c;
+  char* bp;
+  size_t size, largest = 0;
+
+  for(c = pChunks; c != NULL; c = c->next){
+    f(c, c->size, MM_WALK_CHUNK, arg);
+
+    for(bp = CHUNK_FIRST_HDRP(c) + 8; ; bp = NEXT_BLKP(bp)){
+      //the unused end of the current chunk has no tags until mm_malloc carves it up.
+      if(HDRP(bp) == (char*)current_avail && remainingPageSize > 0){
+        f(current_avail, remainingPageSize, MM_WALK_TAIL, arg);
+        bp += remainingPageSize;
+      }
+      size = GET_SIZE(HDRP(bp));
+      if(size == 0){
+        break;
+      }
+      if(!GET_ALLOC(HDRP(bp)) && size > largest){
+        largest = size;
+      }
+      f(bp, size, GET_ALLOC(HDRP(bp)) ? MM_WALK_ALLOC : MM_WALK_FREE, arg);
+    }
+  }
+
+  stats.largest_free = largest;
+  largestFreeKnown = 1;
+}
+
+/**************************************************************************/
+// Heap profiler: roughly one allocation per sampleBytes bytes is picked by a
+// geometric countdown, its backtrace is recorded, and the block stays in the
+// live table (and its header keeps the SAMPLED bit) until it is freed.
+// The tables are mapped directly so they don't count towards the heap.
+
+#define PROFILE_DEPTH 32
+#define PROFILE_MAX_STACKS 4096   //power of two
+#define PROFILE_MAX_LIVE 65536    //power of two
+
+typedef struct {
+  size_t hash;
+  int depth;
+  void* frames[PROFILE_DEPTH];
+  size_t allocCount, allocBytes;
+  size_t liveCount, liveBytes;
+} profile_stack;
+
+typedef struct {
+  void* ptr;            //NULL for an empty slot
+  size_t size;
+  profile_stack* stack;
+} profile_sample;
+
+size_t sampleBytes = 0;
+//the rate the current profile was taken at, kept after mm_profile_stop for the dump.
+size_t profileSampleBytes = 0;
+uint64_t sampleRandom = 88172645463325252ULL;
+profile_stack* profileStacks = NULL;
+profile_sample* profileLive = NULL;
+size_t profileLiveCount = 0;
+
+static void* profileMap(size_t bytes){
+  void* p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  return p == MAP_FAILED ? NULL : p;
+}
+
+/*
+ * nextSampleCountdown - bytes until the next sample, exponentially distributed with
+ *   mean sampleBytes so every byte is equally likely to be the one that triggers it.
+ */
+static long nextSampleCountdown(void){
+  double u;
+
+  sampleRandom ^= sampleRandom << 13;
+  sampleRandom ^= sampleRandom >> 7;
+  sampleRandom ^= sampleRandom << 17;
+  u = ((sampleRandom >> 11) + 1.0) / 9007199254740993.0;   //in (0, 1]
+  return (long)(-log(u) * sampleBytes);
+}
+
+static size_t hashPointer(void* ptr){
+  return ((uintptr_t)ptr >> 4) * 0x9E3779B97F4A7C15ULL;
+}
+
+/*
+ * findStack - the stack table entry for these frames, adding it if it is new.
+ *   Returns NULL when the table is full.
+ */
+static profile_stack* findStack(void** frames, int depth){
+  size_t hash = 0, i, probes;
+  profile_stack* stack;
+  int d;
+
+  for(d = 0; d < depth; d++){
+    hash = (hash + hashPointer(frames[d])) * 31;
+  }
+
+  for(i = hash, probes = 0; probes < PROFILE_MAX_STACKS; i++, probes++){
+    stack = &profileStacks[i & (PROFILE_MAX_STACKS-1)];
+    if(stack->depth == 0){
+      stack->hash = hash;
+      stack->depth = depth;
+      memcpy(stack->frames, frames, depth * sizeof(void*));
+      return stack;
+    }
+    if(stack->hash == hash && stack->depth == depth
+       && memcmp(stack->frames, frames, depth * sizeof(void*)) == 0){
+      return stack;
+    }
+  }
+  return NULL;
+}
+
+static profile_sample* findSample(void* ptr){
+  size_t i = hashPointer(ptr);
+  profile_sample* sample;
+
+  for(;; i++){
+    sample = &profileLive[i & (PROFILE_MAX_LIVE-1)];
+    if(sample->ptr == ptr || sample->ptr == NULL){
+      return sample;
+    }
+  }
+}
+
+/*
+ * removeSample - empty a live table slot, shifting later entries of the probe run back
+ *   so lookups never need tombstones.
+ */
+static void removeSample(profile_sample* sample){
+  size_t hole = sample - profileLive, i, home;
+
+  for(i = (hole + 1) & (PROFILE_MAX_LIVE-1); profileLive[i].ptr != NULL; i = (i + 1) & (PROFILE_MAX_LIVE-1)){
+    home = hashPointer(profileLive[i].ptr) & (PROFILE_MAX_LIVE-1);
+    //the entry at i can fill the hole unless its home lies cyclically in (hole, i].
+    if(((i - home) & (PROFILE_MAX_LIVE-1)) >= ((i - hole) & (PROFILE_MAX_LIVE-1))){
+      profileLive[hole] = profileLive[i];
+      hole = i;
+    }
+  }
+  profileLive[hole].ptr = NULL;
+  profileLiveCount--;
+}
+
+/*
+ * mallocSampled - slow path of mm_malloc once the countdown runs out: allocate the
+ *   block, then record where it was allocated from. caller is mm_malloc's return
+ *   address, where the recorded stack starts.
+ */
+static void* mallocSampled(size_t size, void* caller){
+  void* frames[PROFILE_DEPTH + 2];
+  profile_stack* stack;
+  profile_sample* sample;
+  void* p;
+  int depth, skip;
+
+  if(sampleBytes == 0){
+    sampleCountdown = LONG_MAX;
+    return mallocBlock(size);
+  }
+
+  sampleCountdown = nextSampleCountdown();
+  if((p = mallocBlock(size)) == NULL){
+    return NULL;
+  }
+
+  //keep the table at most half full so probe runs stay short.
+  if(profileLiveCount >= PROFILE_MAX_LIVE/2){
+    return p;
+  }
+
+  //skip mallocSampled, and mm_malloc unless it tail-called us.
+  depth = backtrace(frames, PROFILE_DEPTH + 2);
+  for(skip = 1; skip < depth && frames[skip] != caller; skip++){
+  }
+  if(skip == depth){
+    skip = 1;
+  }
+  depth = MIN(depth - skip, PROFILE_DEPTH);
+  if(depth <= 0 || (stack = findStack(frames + skip, depth)) == NULL){
+    return p;
+  }
+
+  stack->allocCount++;
+  stack->allocBytes += size;
+  stack->liveCount++;
+  stack->liveBytes += size;
+
+  sample = findSample(p);
+  sample->ptr = p;
+  sample->size = size;
+  sample->stack = stack;
+  profileLiveCount++;
+
+  PUT(HDRP(p), GET(HDRP(p)) | SAMPLED);
+  PUT(FTRP(p), GET(FTRP(p)) | SAMPLED);
+  return p;
+}
+
+static void freeSampled(void* ptr){
+  profile_sample* sample;
+
+  //a block sampled by a process that has since exited, in a persistent heap.
+  if(profileLive == NULL){
+    return;
+  }
+
+  sample = findSample(ptr);
+  if(sample->ptr == NULL){
+    return;
+  }
+  sample->stack->liveCount--;
+  sample->stack->liveBytes -= sample->size;
+  removeSample(sample);
+}
+
+static void moveSample(void* from, void* to){
+  profile_sample* sample;
+  profile_sample moved;
+
+  if(profileLive == NULL){
+    return;
+  }
+
+  sample = findSample(from);
+  if(sample->ptr == NULL){
+    return;
+  }
+  moved = *sample;
+  removeSample(sample);
+  moved.ptr = to;
+  *findSample(to) = moved;
+  profileLiveCount++;
+}
+
+/*
+ * mm_profile_start - start sampling about one allocation per sample_bytes bytes,
+ *     dropping any earlier profile.
+ */
+void mm_profile_start(size_t sample_bytes)
+{
+  if(profileStacks == NULL){
+    profileStacks = profileMap(PROFILE_MAX_STACKS * sizeof(profile_stack));
+    profileLive = profileMap(PROFILE_MAX_LIVE * sizeof(profile_sample));
+    if(profileStacks == NULL || profileLive == NULL){
+      return;
+    }
+  } else {
+    memset(profileStacks, 0, PROFILE_MAX_STACKS * sizeof(profile_stack));
+    memset(profileLive, 0, PROFILE_MAX_LIVE * sizeof(profile_sample));
+  }
+  profileLiveCount = 0;
+
+  sampleBytes = sample_bytes;
+  profileSampleBytes = sample_bytes;
+  sampleCountdown = sample_bytes ? nextSampleCountdown() : LONG_MAX;
+}
+
+/*
+ * mm_profile_stop - stop sampling; blocks already sampled are still tracked until freed.
+ */
+void mm_profile_stop(void)
+{
+  sampleBytes = 0;
+  sampleCountdown = LONG_MAX;
+}
+
+/*
+ * mm_profile_dump - write the profile in the legacy heap profile format that pprof
+ *     reads: live and total sampled counts and bytes per allocation stack, followed
+ *     by the process mappings so the addresses can be symbolized.
+ */
+void mm_profile_dump(FILE *out)
+{
+  size_t allocCount = 0, allocBytes = 0, liveCount = 0, liveBytes = 0, i;
+  profile_stack* stack;
+  FILE* maps;
+  char line[1024];
+  int d;
+
+  if(profileStacks == NULL){
+    return;
+  }
+
+  for(i = 0; i < PROFILE_MAX_STACKS; i++){
+    stack = &profileStacks[i];
+    allocCount += stack->allocCount;
+    allocBytes += stack->allocBytes;
+    liveCount += stack->liveCount;
+    liveBytes += stack->liveBytes;
+  }
+
+  fprintf(out, "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/%zu\n",
+          liveCount, liveBytes, allocCount, allocBytes, profileSampleBytes);
+  for(i = 0; i < PROFILE_MAX_STACKS; i++){
+    stack = &profileStacks[i];
+    if(stack->depth == 0){
+      continue;
+    }
+    fprintf(out, "%zu: %zu [%zu: %zu] @", stack->liveCount, stack->liveBytes,
+            stack->allocCount, stack->allocBytes);
+    for(d = 0; d < stack->depth; d++){
+      fprintf(out, " %p", stack->frames[d]);
+    }
+    fprintf(out, "\n");
+  }
+
+  fprintf(out, "\nMAPPED_LIBRARIES:\n");
+  if((maps = fopen("/proc/self/maps", "r")) != NULL){
+    while(fgets(line, sizeof(line), maps) != NULL){
+      fputs(line, out);
+    }
+    fclose(maps);
+  }
+}
+
+/*
+ * dropLiveSamples - the heap is being thrown away wholesale, so nothing sampled is live.
+ */
+static void dropLiveSamples(void){
+  size_t i;
+
+  if(profileStacks == NULL){
+    return;
+  }
+  for(i = 0; i < PROFILE_MAX_STACKS; i++){
+    profileStacks[i].liveCount = 0;
+    profileStacks[i].liveBytes = 0;
+  }
+  memset(profileLive, 0, PROFILE_MAX_LIVE * sizeof(profile_sample));
+  profileLiveCount = 0;
+}
+/**************************************************************************/
+
 void addNodeToFreeList(void* ptr){
+  size_t size = GET_SIZE(HDRP(ptr));
+
+  stats.free_bytes += size;
+  stats.free_blocks++;
+  stats.free_class_bytes[sizeClass(size)] += size;
+  if(largestFreeKnown && size > stats.largest_free){
+    stats.largest_free = size;
+  }
+
   ((node*)ptr)->prev = pLastFree;
   
   if(pLastFree != NULL){
@@ -189,6 +1045,18 @@ void addNodeToFreeList(void* ptr){
 }
 
 void removeNodeFromFreeList(node* currNode){
+  size_t size = GET_SIZE(HDRP(currNode));
+
+  stats.free_bytes -= size;
+  stats.free_blocks--;
+  stats.free_class_bytes[sizeClass(size)] -= size;
+  if(stats.free_blocks == 0){
+    stats.largest_free = 0;
+    largestFreeKnown = 1;
+  } else if(size == stats.largest_free){
+    largestFreeKnown = 0;
+  }
+
   if(currNode == pLastFree){
     //shrink the list by one, 
     pLastFree = currNode->prev;
@@ -241,6 +1109,92 @@ void* findFreeBlockAndRemoveFromFreeList(size_t size){
   return currNode;
 }
 
+/*
+ * findBestFitAndRemoveFromFreeList - like findFreeBlockAndRemoveFromFreeList, but looks at
+ *     the whole list for the smallest block that fits. Only used at the memory cap.
+ */
+static void* findBestFitAndRemoveFromFreeList(size_t size){
+  node* currNode;
+  node* best = NULL;
+
+  for(currNode = pLastFree; currNode != NULL; currNode = currNode->prev){
+    if(GET_SIZE(HDRP(currNode)) >= size
+       && (best == NULL || GET_SIZE(HDRP(currNode)) < GET_SIZE(HDRP(best)))){
+      best = currNode;
+      if(GET_SIZE(HDRP(best)) == size){
+        break;
+      }
+    }
+  }
+  if(best != NULL){
+    removeNodeFromFreeList(best);
+  }
+  return best;
+}
+
+/*
+ * reclaimFreeSpace - walk every chunk merging runs of neighbouring free blocks, which mm_free
+ *     never does, and rebuild the free list from the result. A chunk that turns out to be
+ *     one free block is unmapped. Slow, so only used once mem_map has hit the memory cap.
+ */
+static void reclaimFreeSpace(void){
+  chunk* c;
+  chunk* next;
+  char* bp;
+  char* run;
+  size_t size;
+
+  //every free block is about to be added back, merged or not.
+  pLastFree = NULL;
+  stats.free_bytes = 0;
+  stats.free_blocks = 0;
+  memset(stats.free_class_bytes, 0, sizeof(stats.free_class_bytes));
+  stats.largest_free = 0;
+  largestFreeKnown = 1;
+
+  for(c = pChunks; c != NULL; c = next){
+    next = c->next;
+    run = NULL;
+    for(bp = CHUNK_FIRST_HDRP(c) + 8; ; bp = NEXT_BLKP(bp)){
+      //the untouched tail isn't a block, so it ends a run like an allocated block does.
+      if(HDRP(bp) == (char*)current_avail && remainingPageSize > 0){
+        if(run != NULL){
+          addNodeToFreeList(run);
+          run = NULL;
+        }
+        bp += remainingPageSize;
+      }
+      size = GET_SIZE(HDRP(bp));
+      if(size != 0 && !GET_ALLOC(HDRP(bp))){
+        if(run == NULL){
+          run = bp;
+        } else {
+          PUT(HDRP(run), PACK(bp + size - run, 0));
+          PUT(FTRP(run), GET(HDRP(run)));
+        }
+        continue;
+      }
+
+      if(run != NULL && size == 0 && HDRP(run) == CHUNK_FIRST_HDRP(c)){
+        if((char*)current_avail > (char*)c && (char*)current_avail < (char*)c + c->size){
+          current_avail = NULL;
+          remainingPageSize = 0;
+        }
+        unlinkChunk(c);
+        stats.mapped_bytes -= c->size;
+        stats.chunks--;
+        mem_unmap(c, c->size);
+      } else if(run != NULL){
+        addNodeToFreeList(run);
+      }
+      run = NULL;
+      if(size == 0){
+        break;
+      }
+    }
+  }
+}
+
 /**
  * @brief alligns the size to fit a page, then creates page headers/footers w/ size 0 marked as allocated to indicate the start/end of the the page.
  * 
@@ -266,7 +1220,7 @@ void* initializeNewPage(size_t size){
   return pPage +16;
 }
 
-void addRemainingSpaceAsFree(void* ptr, int size){
+void addRemainingSpaceAsFree(void* ptr, size_t size){
 
   PUT(ptr, PACK(size, 0));
   PUT(ptr+size-8, PACK(size, 0));
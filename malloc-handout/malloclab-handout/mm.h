@@ -3,3 +3,43 @@
 extern int mm_init (void);
 extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
+extern void *mm_realloc (void *ptr, size_t size);
+extern void *mm_memalign (size_t alignment, size_t size);
+extern size_t mm_usable_size (void *ptr);
+
+/* persistent heap backed by a file */
+extern int mm_attach (const char *path);
+extern void mm_detach (void);
+extern void mm_set_root (void *ptr);
+extern void *mm_get_root (void);
+
+/* heap introspection */
+#define MM_SIZE_CLASSES 16
+
+struct mm_stats {
+  size_t mapped_bytes;   /* bytes in all chunks */
+  size_t chunks;         /* number of chunks */
+  size_t live_bytes;     /* bytes in allocated blocks, tags included */
+  size_t live_blocks;    /* number of allocated blocks */
+  size_t free_bytes;     /* bytes in free blocks */
+  size_t free_blocks;    /* number of free blocks */
+  size_t free_class_bytes[MM_SIZE_CLASSES]; /* class i: blocks of [32<<i, 64<<i) */
+  size_t tail_bytes;     /* untouched end of the chunk being carved up */
+  size_t largest_free;   /* largest free block or tail; after the largest
+                            free block is reused and until the next
+                            mm_walk, only the bottom of its size class */
+  double frag_index;     /* 1 - largest_free / (free_bytes + tail_bytes) */
+};
+
+enum { MM_WALK_CHUNK, MM_WALK_ALLOC, MM_WALK_FREE, MM_WALK_TAIL };
+
+/* ptr is the chunk, a block's payload or the tail; size includes tags */
+typedef void (*mm_walk_callback)(void *ptr, size_t size, int kind, void *arg);
+
+extern void mm_stats (struct mm_stats *stats);
+extern void mm_walk (mm_walk_callback f, void *arg);
+
+/* sampling heap profiler */
+extern void mm_profile_start (size_t sample_bytes);
+extern void mm_profile_stop (void);
+extern void mm_profile_dump (FILE *out);
@@ -0,0 +1,175 @@
+/*
+ * mmpreload.c - libc malloc interface on top of mm.c, for LD_PRELOAD
+ *
+ * Built into libmm.so together with mm.c and a memlib.c compiled with
+ * MEM_NO_PAGEMAP:
+ *
+ *	unix> LD_PRELOAD=./libmm.so some-program
+ *
+ * mm.c is single-threaded, so every call takes one global lock. The
+ * lock is statically initialized and the package initializes itself on
+ * the first call, and neither step needs malloc, so the very first
+ * allocations made by the dynamic loader and libc's own startup code
+ * are safe.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+#define EXPORT __attribute__((visibility("default")))
+
+static pthread_mutex_t mm_lock = PTHREAD_MUTEX_INITIALIZER;
+static int initialized = 0;
+
+static void lock_for_fork(void)
+{
+  pthread_mutex_lock(&mm_lock);
+}
+
+static void unlock_after_fork(void)
+{
+  pthread_mutex_unlock(&mm_lock);
+}
+
+/*
+ * lock - take the global lock, initializing the package on first use
+ */
+static void lock(void)
+{
+  pthread_mutex_lock(&mm_lock);
+  if (!initialized) {
+    initialized = 1;
+    mem_init();
+    mm_init();
+    /* keep the heap consistent in a child forked mid-call */
+    pthread_atfork(lock_for_fork, unlock_after_fork, unlock_after_fork);
+  }
+}
+
+static void unlock(void)
+{
+  pthread_mutex_unlock(&mm_lock);
+}
+
+EXPORT void *malloc(size_t size)
+{
+  void *p;
+
+  lock();
+  p = mm_malloc(size);
+  unlock();
+  if (p == NULL)
+    errno = ENOMEM;
+  return p;
+}
+
+EXPORT void free(void *ptr)
+{
+  if (ptr == NULL)
+    return;
+  lock();
+  mm_free(ptr);
+  unlock();
+}
+
+EXPORT void *realloc(void *ptr, size_t size)
+{
+  void *p;
+
+  lock();
+  p = mm_realloc(ptr, size);
+  unlock();
+  if (p == NULL && size != 0)
+    errno = ENOMEM;
+  return p;
+}
+
+EXPORT void *calloc(size_t nmemb, size_t size)
+{
+  void *p;
+
+  if (size != 0 && nmemb > SIZE_MAX / size) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  /* not malloc + memset: gcc folds that pair back into a call to calloc */
+  lock();
+  p = mm_malloc(nmemb * size);
+  unlock();
+  if (p == NULL) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  memset(p, 0, nmemb * size);
+  return p;
+}
+
+EXPORT int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+  void *p;
+
+  if (alignment < sizeof(void *) || (alignment & (alignment - 1)) != 0)
+    return EINVAL;
+  lock();
+  p = mm_memalign(alignment, size);
+  unlock();
+  if (p == NULL)
+    return ENOMEM;
+  *memptr = p;
+  return 0;
+}
+
+EXPORT void *memalign(size_t alignment, size_t size)
+{
+  void *p;
+
+  if ((alignment & (alignment - 1)) != 0) {
+    errno = EINVAL;
+    return NULL;
+  }
+  lock();
+  p = mm_memalign(alignment, size);
+  unlock();
+  if (p == NULL)
+    errno = ENOMEM;
+  return p;
+}
+
+EXPORT void *aligned_alloc(size_t alignment, size_t size)
+{
+  return memalign(alignment, size);
+}
+
+EXPORT void *valloc(size_t size)
+{
+  return memalign(getpagesize(), size);
+}
+
+EXPORT void *pvalloc(size_t size)
+{
+  size_t page = getpagesize();
+
+  if (size > SIZE_MAX - page) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  return memalign(page, (size + page - 1) & ~(page - 1));
+}
+
+EXPORT size_t malloc_usable_size(void *ptr)
+{
+  size_t size;
+
+  if (ptr == NULL)
+    return 0;
+  lock();
+  size = mm_usable_size(ptr);
+  unlock();
+  return size;
+}
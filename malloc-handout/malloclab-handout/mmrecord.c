@@ -0,0 +1,566 @@
+/*
+ * mmrecord.c - record the allocations of a real program as a trace
+ *
+ * Built into libmmrecord.so:
+ *
+ *	unix> MMRECORD_FILE=ls.rep LD_PRELOAD=./libmmrecord.so ls -l
+ *	unix> mdriver -v -f ls.rep
+ *
+ * malloc, free, realloc, calloc and the memalign family are passed on
+ * to libc's and logged on the way. Each thread appends fixed-size
+ * records to a single-producer ring of its own, with no locks, and a
+ * flusher thread copies the rings to a raw file next to the trace.
+ * Records carry a global sequence number, taken before a block is
+ * released and after one is obtained, so that sorting by it gives an
+ * order in which no address is in use twice.
+ *
+ * At exit the raw file is sorted, addresses are turned into block ids,
+ * blocks still live are freed at the end so the trace is balanced, and
+ * the trace is written with its header filled in: as text, or binary
+ * if MMRECORD_FILE ends in ".bin". A "%p" in MMRECORD_FILE becomes the
+ * process id, which keeps the programs a shell script runs apart. The
+ * default is mmrecord.<pid>.rep. A process that calls execve or _exit
+ * writes its trace first, since no destructor runs on those paths.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+
+#define EXPORT __attribute__((visibility("default")))
+#define TLS __thread __attribute__((tls_model("initial-exec")))
+
+#define RING_SIZE (1 << 16)      /* records per thread ring, a power of two */
+#define ARENA_SIZE (64 * 1024)   /* bootstrap memory while dlsym runs */
+
+int verbose = 0;  /* read by trace.c */
+
+/* One logged call */
+enum { REC_MALLOC, REC_FREE, REC_REALLOC_BEGIN, REC_REALLOC_END };
+
+typedef struct {
+  uint64_t seq;
+  uint64_t size;
+  void *ptr;
+  uint32_t type;
+  uint32_t thread;  /* ring number, to pair the two halves of a realloc */
+} record_t;
+
+/* Single-producer, single-consumer ring of one thread */
+typedef struct ring {
+  uint64_t head;            /* next record the thread writes */
+  char pad[56];
+  uint64_t tail;            /* next record the flusher copies */
+  struct ring *next;        /* all rings, newest first */
+  uint32_t id;
+  record_t recs[RING_SIZE];
+} ring_t;
+
+static void *(*real_malloc)(size_t);
+static void (*real_free)(void *);
+static void *(*real_calloc)(size_t, size_t);
+static void *(*real_realloc)(void *, size_t);
+static int (*real_posix_memalign)(void **, size_t, size_t);
+static void *(*real_memalign)(size_t, size_t);
+static void *(*real_aligned_alloc)(size_t, size_t);
+static int (*real_execve)(const char *, char *const [], char *const []);
+static void (*real_exit)(int) __attribute__((noreturn));
+
+static char arena[ARENA_SIZE] __attribute__((aligned(16)));
+static size_t arena_used;
+static int resolving;
+
+static int recording;           /* 0 before startup and after shutdown */
+static uint64_t next_seq;
+static ring_t *rings;
+static uint32_t num_rings;
+static int raw_fd = -1;
+static pid_t owner_pid;
+static pthread_t flusher_thread;
+static int stopping;
+static char out_path[PATH_MAX];
+static char raw_path[PATH_MAX + 8];
+
+static TLS ring_t *my_ring;
+static TLS int busy;            /* set while we are the ones allocating */
+
+/*
+ * arena_alloc - memory for the calls dlsym makes before libc's malloc
+ * is known; it is never freed
+ */
+static void *arena_alloc(size_t size)
+{
+  void *p;
+
+  size = (size + 15) & ~(size_t)15;
+  if (arena_used + size > ARENA_SIZE)
+    return NULL;
+  p = arena + arena_used;
+  arena_used += size;
+  return p;
+}
+
+static int in_arena(void *p)
+{
+  return (char *)p >= arena && (char *)p < arena + ARENA_SIZE;
+}
+
+static void resolve(void)
+{
+  resolving = 1;
+  real_malloc = dlsym(RTLD_NEXT, "malloc");
+  real_free = dlsym(RTLD_NEXT, "free");
+  real_calloc = dlsym(RTLD_NEXT, "calloc");
+  real_realloc = dlsym(RTLD_NEXT, "realloc");
+  real_posix_memalign = dlsym(RTLD_NEXT, "posix_memalign");
+  real_memalign = dlsym(RTLD_NEXT, "memalign");
+  real_aligned_alloc = dlsym(RTLD_NEXT, "aligned_alloc");
+  resolving = 0;
+}
+
+static uint64_t take_seq(void)
+{
+  return __atomic_fetch_add(&next_seq, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * new_ring - map a ring for this thread and add it to the list; mmap
+ * rather than malloc, since we are inside malloc
+ */
+static ring_t *new_ring(void)
+{
+  ring_t *r = mmap(NULL, sizeof(ring_t), PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  if (r == MAP_FAILED)
+    return NULL;
+  r->id = __atomic_fetch_add(&num_rings, 1, __ATOMIC_RELAXED);
+  r->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&rings, &r->next, r, 1,
+                                      __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    ;
+  return r;
+}
+
+/*
+ * record - append one record to this thread's ring, waiting for the
+ * flusher if the ring is full
+ */
+static void record(uint64_t seq, int type, void *ptr, size_t size)
+{
+  ring_t *r;
+  record_t *rec;
+  uint64_t head;
+
+  if (busy || !__atomic_load_n(&recording, __ATOMIC_RELAXED))
+    return;
+  if ((r = my_ring) == NULL && (r = my_ring = new_ring()) == NULL)
+    return;
+  head = r->head;
+  while (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >= RING_SIZE) {
+    if (!__atomic_load_n(&recording, __ATOMIC_RELAXED))
+      return;
+    sched_yield();
+  }
+  rec = &r->recs[head & (RING_SIZE - 1)];
+  rec->seq = seq;
+  rec->size = size;
+  rec->ptr = ptr;
+  rec->type = type;
+  rec->thread = r->id;
+  __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * drain_rings - copy every record written so far to the raw file,
+ * returning how many were copied
+ */
+static uint64_t drain_rings(void)
+{
+  ring_t *r;
+  uint64_t head, tail, n, total = 0;
+  size_t first;
+
+  for (r = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); r; r = r->next) {
+    head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    tail = r->tail;
+    if ((n = head - tail) == 0)
+      continue;
+    first = RING_SIZE - (tail & (RING_SIZE - 1));
+    if (first > n)
+      first = n;
+    if (write(raw_fd, &r->recs[tail & (RING_SIZE - 1)],
+              first * sizeof(record_t)) < 0 ||
+        (n > first && write(raw_fd, r->recs,
+                            (n - first) * sizeof(record_t)) < 0))
+      perror("mmrecord: write");
+    __atomic_store_n(&r->tail, head, __ATOMIC_RELEASE);
+    total += n;
+  }
+  return total;
+}
+
+static void *flusher(void *arg)
+{
+  busy = 1;
+  while (!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE))
+    if (drain_rings() == 0)
+      usleep(1000);
+  return NULL;
+}
+
+/* A forked child has no flusher, so it stops recording */
+static void stop_in_child(void)
+{
+  recording = 0;
+}
+
+__attribute__((constructor))
+static void start_recording(void)
+{
+  char *path = getenv("MMRECORD_FILE"), *pid;
+
+  if (real_malloc == NULL)
+    resolve();
+  busy = 1;
+  if (path == NULL)
+    snprintf(out_path, sizeof(out_path), "mmrecord.%d.rep", (int)getpid());
+  else if ((pid = strstr(path, "%p")) != NULL)
+    snprintf(out_path, sizeof(out_path), "%.*s%d%s",
+             (int)(pid - path), path, (int)getpid(), pid + 2);
+  else
+    snprintf(out_path, sizeof(out_path), "%s", path);
+  snprintf(raw_path, sizeof(raw_path), "%s.raw", out_path);
+  if ((raw_fd = open(raw_path, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) {
+    perror("mmrecord: open");
+    busy = 0;
+    return;
+  }
+  owner_pid = getpid();
+  pthread_atfork(NULL, NULL, stop_in_child);
+  if (pthread_create(&flusher_thread, NULL, flusher, NULL) != 0) {
+    close(raw_fd);
+    busy = 0;
+    return;
+  }
+  recording = 1;
+  busy = 0;
+}
+
+/*
+ * Addresses to block ids, for turning the raw records into a trace:
+ * open addressing with linear probing and backward-shift deletion
+ */
+typedef struct {
+  void *ptr;
+  int id;
+} slot_t;
+
+static slot_t *slots;
+static size_t slot_mask, slots_used;
+
+static size_t slot_of(void *p)
+{
+  return ((uintptr_t)p >> 4) * 0x9e3779b97f4a7c15ULL >> 20 & slot_mask;
+}
+
+static void put_id(void *p, int id);
+
+static void grow_slots(void)
+{
+  slot_t *old = slots;
+  size_t i, n = slots ? slot_mask + 1 : 0;
+
+  slot_mask = n ? 2 * n - 1 : 4095;
+  slots = real_calloc(slot_mask + 1, sizeof(slot_t));
+  slots_used = 0;
+  for (i = 0; i < n; i++)
+    if (old[i].ptr)
+      put_id(old[i].ptr, old[i].id);
+  real_free(old);
+}
+
+static void put_id(void *p, int id)
+{
+  size_t i;
+
+  if (2 * (slots_used + 1) > slot_mask + 1)
+    grow_slots();
+  for (i = slot_of(p); slots[i].ptr && slots[i].ptr != p; i = (i + 1) & slot_mask)
+    ;
+  if (slots[i].ptr == NULL)
+    slots_used++;
+  slots[i].ptr = p;
+  slots[i].id = id;
+}
+
+/*
+ * take_id - remove p from the map, returning its id or -1 if unknown
+ */
+static int take_id(void *p)
+{
+  size_t hole, i, home;
+  int id;
+
+  for (i = slot_of(p); slots[i].ptr != p; i = (i + 1) & slot_mask)
+    if (slots[i].ptr == NULL)
+      return -1;
+  id = slots[i].id;
+  for (hole = i;;) {
+    i = (i + 1) & slot_mask;
+    if (slots[i].ptr == NULL)
+      break;
+    home = slot_of(slots[i].ptr);
+    if (((i - home) & slot_mask) >= ((i - hole) & slot_mask)) {
+      slots[hole] = slots[i];
+      hole = i;
+    }
+  }
+  slots[hole].ptr = NULL;
+  slots_used--;
+  return id;
+}
+
+static int by_seq(const void *a, const void *b)
+{
+  uint64_t x = ((const record_t *)a)->seq, y = ((const record_t *)b)->seq;
+
+  return (x > y) - (x < y);
+}
+
+static void add_op(trace_t *t, int *max, int type, int index, int size)
+{
+  if (t->num_ops == *max) {
+    *max = *max ? 2 * *max : 4096;
+    t->ops = real_realloc(t->ops, *max * sizeof(traceop_t));
+  }
+  t->ops[t->num_ops].type = type;
+  t->ops[t->num_ops].index = index;
+  t->ops[t->num_ops].size = size;
+  t->num_ops++;
+}
+
+/*
+ * write_trace - turn the sorted raw records into a trace and write it
+ */
+static void write_trace(record_t *recs, size_t n)
+{
+  trace_t t;
+  int max_ops = 0, id, *pending;
+  size_t i, len = strlen(out_path);
+  double total = 0;
+  FILE *out;
+
+  memset(&t, 0, sizeof(t));
+  grow_slots();
+  pending = real_malloc((num_rings + 1) * sizeof(int));
+  for (i = 0; i <= num_rings; i++)
+    pending[i] = -1;
+
+  for (i = 0; i < n; i++) {
+    record_t *r = &recs[i];
+    int size = r->size == 0 ? 1 : r->size > INT_MAX ? INT_MAX : (int)r->size;
+
+    switch (r->type) {
+    case REC_MALLOC:
+      id = t.num_ids++;
+      put_id(r->ptr, id);
+      add_op(&t, &max_ops, ALLOC, id, size);
+      total += size;
+      break;
+    case REC_FREE:
+      if ((id = take_id(r->ptr)) >= 0)
+        add_op(&t, &max_ops, FREE, id, 0);
+      break;
+    case REC_REALLOC_BEGIN:
+      /* The old block is released here; it may be reused before END */
+      if ((pending[r->thread] = take_id(r->ptr)) >= 0) {
+        add_op(&t, &max_ops, REALLOC, pending[r->thread], size);
+        total += size;
+      }
+      break;
+    case REC_REALLOC_END:
+      /* A block allocated before recording started is new to us */
+      if ((id = pending[r->thread]) < 0) {
+        id = t.num_ids++;
+        add_op(&t, &max_ops, ALLOC, id, size);
+        total += size;
+      }
+      put_id(r->ptr, id);
+      pending[r->thread] = -1;
+      break;
+    }
+  }
+
+  /* Free what is still live, so the trace is balanced */
+  for (i = 0; i <= slot_mask; i++)
+    if (slots[i].ptr)
+      add_op(&t, &max_ops, FREE, slots[i].id, 0);
+
+  t.sugg_heapsize = total + 100 > INT_MAX ? INT_MAX : (int)total + 100;
+  t.weight = 1;
+  if ((out = fopen(out_path, "w")) == NULL) {
+    perror("mmrecord: fopen");
+    return;
+  }
+  if (len > 4 && strcmp(out_path + len - 4, ".bin") == 0)
+    write_trace_bin(out, &t);
+  else
+    write_trace_rep(out, &t);
+  fclose(out);
+  real_free(t.ops);
+  real_free(pending);
+  real_free(slots);
+}
+
+__attribute__((destructor))
+static void stop_recording(void)
+{
+  struct stat st;
+  record_t *recs;
+
+  if (!recording || getpid() != owner_pid)
+    return;
+  busy = 1;
+  __atomic_store_n(&recording, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+  pthread_join(flusher_thread, NULL);
+  drain_rings();
+
+  if (fstat(raw_fd, &st) == 0 && st.st_size > 0) {
+    recs = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, raw_fd, 0);
+    if (recs != MAP_FAILED) {
+      qsort(recs, st.st_size / sizeof(record_t), sizeof(record_t), by_seq);
+      write_trace(recs, st.st_size / sizeof(record_t));
+      munmap(recs, st.st_size);
+    }
+  }
+  close(raw_fd);
+  unlink(raw_path);
+}
+
+EXPORT void *malloc(size_t size)
+{
+  void *p;
+
+  if (real_malloc == NULL) {
+    if (resolving)
+      return arena_alloc(size);
+    resolve();
+  }
+  if ((p = real_malloc(size)) != NULL)
+    record(take_seq(), REC_MALLOC, p, size);
+  return p;
+}
+
+EXPORT void free(void *ptr)
+{
+  if (ptr == NULL || in_arena(ptr))
+    return;
+  if (real_free == NULL)
+    resolve();
+  record(take_seq(), REC_FREE, ptr, 0);
+  real_free(ptr);
+}
+
+EXPORT void *calloc(size_t n, size_t size)
+{
+  void *p;
+
+  if (real_calloc == NULL) {
+    if (resolving)
+      return (n && size > ARENA_SIZE / n) ? NULL : arena_alloc(n * size);
+    resolve();
+  }
+  if ((p = real_calloc(n, size)) != NULL)
+    record(take_seq(), REC_MALLOC, p, n * size);
+  return p;
+}
+
+EXPORT void *realloc(void *ptr, size_t size)
+{
+  void *p;
+  uint64_t seq;
+
+  if (real_realloc == NULL)
+    resolve();
+  if (ptr == NULL)
+    return malloc(size);
+  if (in_arena(ptr)) {
+    size_t left = arena + ARENA_SIZE - (char *)ptr;
+
+    if ((p = malloc(size)) != NULL)
+      memcpy(p, ptr, size < left ? size : left);
+    return p;
+  }
+  seq = take_seq();
+  if ((p = real_realloc(ptr, size)) == NULL) {
+    if (size == 0)                     /* glibc frees the block */
+      record(seq, REC_FREE, ptr, 0);
+    return p;
+  }
+  record(seq, REC_REALLOC_BEGIN, ptr, size);
+  record(take_seq(), REC_REALLOC_END, p, size);
+  return p;
+}
+
+EXPORT int execve(const char *path, char *const argv[], char *const envp[])
+{
+  if (real_execve == NULL)
+    real_execve = dlsym(RTLD_NEXT, "execve");
+  stop_recording();
+  return real_execve(path, argv, envp);
+}
+
+EXPORT void _exit(int status)
+{
+  if (real_exit == NULL)
+    real_exit = dlsym(RTLD_NEXT, "_exit");
+  stop_recording();
+  real_exit(status);
+}
+
+EXPORT int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+  int err;
+
+  if (real_posix_memalign == NULL)
+    resolve();
+  if ((err = real_posix_memalign(memptr, alignment, size)) == 0)
+    record(take_seq(), REC_MALLOC, *memptr, size);
+  return err;
+}
+
+EXPORT void *memalign(size_t alignment, size_t size)
+{
+  void *p;
+
+  if (real_memalign == NULL)
+    resolve();
+  if ((p = real_memalign(alignment, size)) != NULL)
+    record(take_seq(), REC_MALLOC, p, size);
+  return p;
+}
+
+EXPORT void *aligned_alloc(size_t alignment, size_t size)
+{
+  void *p;
+
+  if (real_aligned_alloc == NULL)
+    resolve();
+  if ((p = real_aligned_alloc(alignment, size)) != NULL)
+    record(take_seq(), REC_MALLOC, p, size);
+  return p;
+}
@@ -0,0 +1,228 @@
+/*
+ * mtreplay.c - replay copies of a trace on several threads at once
+ *
+ * Each thread runs its own copy of the trace with its own block table.
+ * A fraction of the frees can be handed to the next thread instead,
+ * through a lock-free mailbox that the owner drains every few requests,
+ * so blocks are freed by a thread other than the one that allocated
+ * them. The mm package is not thread safe, so every mm call is made
+ * under one global lock; libc malloc is called directly.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "mtreplay.h"
+#include "memlib.h"
+#include "mm.h"
+
+#define MT_REPS   3  /* runs per measurement; the fastest one counts */
+#define MT_DRAIN 64  /* requests between mailbox drains */
+
+/* Per-thread replay state, padded so threads don't share cache lines */
+typedef struct {
+    pthread_t tid;
+    int id;
+    char **blocks;       /* this thread's copy of trace->blocks */
+    unsigned rng;        /* xorshift32 state for picking remote frees */
+    void *inbox;         /* blocks other threads asked us to free */
+    char pad[64];
+} mt_thread_t;
+
+static trace_t *mt_trace;
+static mt_thread_t *mt_threads;
+static int mt_nthreads;
+static unsigned mt_remote;     /* remote free threshold out of 2^32 */
+static int mt_which;
+static pthread_barrier_t mt_start, mt_done;
+static pthread_mutex_t mm_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void mt_error(char *msg)
+{
+    printf("%s\n", msg);
+    exit(1);
+}
+
+static void *mt_malloc(size_t size)
+{
+    void *p;
+
+    if (mt_which == MT_LIBC)
+	return malloc(size);
+    pthread_mutex_lock(&mm_lock);
+    p = mm_malloc(size);
+    pthread_mutex_unlock(&mm_lock);
+    return p;
+}
+
+static void *mt_realloc(void *ptr, size_t size)
+{
+    void *p;
+
+    if (mt_which == MT_LIBC)
+	return realloc(ptr, size);
+    pthread_mutex_lock(&mm_lock);
+    p = mm_realloc(ptr, size);
+    pthread_mutex_unlock(&mm_lock);
+    return p;
+}
+
+static void mt_free(void *ptr)
+{
+    if (mt_which == MT_LIBC) {
+	free(ptr);
+	return;
+    }
+    pthread_mutex_lock(&mm_lock);
+    mm_free(ptr);
+    pthread_mutex_unlock(&mm_lock);
+}
+
+/*
+ * mt_post - push block p onto thread t's mailbox; the first word of the
+ *     payload links the mailbox, which is safe since every trace
+ *     payload is at least 8 bytes once aligned
+ */
+static void mt_post(mt_thread_t *t, void *p)
+{
+    void *head = __atomic_load_n(&t->inbox, __ATOMIC_RELAXED);
+
+    do {
+	*(void **)p = head;
+    } while (!__atomic_compare_exchange_n(&t->inbox, &head, p, 1,
+					  __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/*
+ * mt_drain - free every block posted to thread t
+ */
+static void mt_drain(mt_thread_t *t)
+{
+    void *p = __atomic_exchange_n(&t->inbox, NULL, __ATOMIC_ACQUIRE);
+    void *next;
+
+    for (; p != NULL; p = next) {
+	next = *(void **)p;
+	mt_free(p);
+    }
+}
+
+/*
+ * mt_run - body of one replay thread
+ */
+static void *mt_run(void *arg)
+{
+    mt_thread_t *self = arg;
+    mt_thread_t *peer = &mt_threads[(self->id + 1) % mt_nthreads];
+    trace_t *trace = mt_trace;
+    char *p;
+    int i;
+
+    pthread_barrier_wait(&mt_start);
+    for (i = 0; i < trace->num_ops; i++) {
+	switch (trace->ops[i].type) {
+	case ALLOC:
+	    if ((p = mt_malloc(trace->ops[i].size)) == NULL)
+		mt_error("malloc error in mt_replay");
+	    self->blocks[trace->ops[i].index] = p;
+	    break;
+	case REALLOC:
+	    p = self->blocks[trace->ops[i].index];
+	    if ((p = mt_realloc(p, trace->ops[i].size)) == NULL)
+		mt_error("realloc error in mt_replay");
+	    self->blocks[trace->ops[i].index] = p;
+	    break;
+	case FREE:
+	    p = self->blocks[trace->ops[i].index];
+	    self->rng ^= self->rng << 13;
+	    self->rng ^= self->rng >> 17;
+	    self->rng ^= self->rng << 5;
+	    if (peer != self && self->rng < mt_remote)
+		mt_post(peer, p);
+	    else
+		mt_free(p);
+	    break;
+	}
+	if (i % MT_DRAIN == 0)
+	    mt_drain(self);
+    }
+
+    /* Nothing more can be posted once every thread is past the barrier */
+    pthread_barrier_wait(&mt_done);
+    mt_drain(self);
+    return NULL;
+}
+
+/*
+ * mt_once - run nthreads copies of the trace once, returning the
+ *     elapsed seconds from the common start until the last thread ends
+ */
+static double mt_once(void)
+{
+    struct timespec t0, t1;
+    int i;
+
+    if (mt_which == MT_MM) {
+	mem_reset();
+	if (mm_init() < 0)
+	    mt_error("mm_init failed in mt_replay");
+    }
+
+    for (i = 0; i < mt_nthreads; i++) {
+	mt_threads[i].rng = 2463534242u + i;
+	mt_threads[i].inbox = NULL;
+	if (pthread_create(&mt_threads[i].tid, NULL, mt_run, &mt_threads[i]))
+	    mt_error("pthread_create failed in mt_replay");
+    }
+    pthread_barrier_wait(&mt_start);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0; i < mt_nthreads; i++)
+	pthread_join(mt_threads[i].tid, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    if (mt_which == MT_MM)
+	mem_reset();
+    return (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+}
+
+/*
+ * mt_replay - replay nthreads copies of trace concurrently with mm.c
+ *     (MT_MM) or libc malloc (MT_LIBC), handing remote_frac of the frees
+ *     to another thread. Returns the best elapsed time in seconds over MT_REPS runs.
+ */
+double mt_replay(trace_t *trace, int nthreads, double remote_frac, int which)
+{
+    double secs, best = 0;
+    int i;
+
+    mt_trace = trace;
+    mt_nthreads = nthreads;
+    mt_which = which;
+    mt_remote = (remote_frac >= 1.0) ? 0xffffffffu
+	: (unsigned)(remote_frac * 4294967296.0);
+    if ((mt_threads = calloc(nthreads, sizeof(mt_thread_t))) == NULL)
+	mt_error("calloc failed in mt_replay");
+    for (i = 0; i < nthreads; i++) {
+	mt_threads[i].id = i;
+	if ((mt_threads[i].blocks = 
+	     malloc(trace->num_ids * sizeof(char *))) == NULL)
+	    mt_error("malloc failed in mt_replay");
+    }
+    pthread_barrier_init(&mt_start, NULL, nthreads + 1);
+    pthread_barrier_init(&mt_done, NULL, nthreads);
+
+    for (i = 0; i < MT_REPS; i++) {
+	secs = mt_once();
+	if (i == 0 || secs < best)
+	    best = secs;
+    }
+
+    pthread_barrier_destroy(&mt_start);
+    pthread_barrier_destroy(&mt_done);
+    for (i = 0; i < nthreads; i++)
+	free(mt_threads[i].blocks);
+    free(mt_threads);
+    return best;
+}
@@ -0,0 +1,14 @@
+#ifndef __MTREPLAY_H_
+#define __MTREPLAY_H_
+
+/*
+ * mtreplay.h - replay copies of a trace on several threads at once
+ */
+#include "trace.h"
+
+/* Allocators mt_replay can drive */
+enum { MT_MM, MT_LIBC };
+
+double mt_replay(trace_t *trace, int nthreads, double remote_frac, int which);
+
+#endif /* __MTREPLAY_H_ */
@@ -88,6 +88,13 @@ int pagemap_is_mapped(void *p) {
   return !!page_maps3[PAGEMAP64_LEVEL3_BITS(p)].addr;
 }
 
+/* Like pagemap_for_each, but leaves the pages mapped */
+void pagemap_visit(page_callback f) {
+  mpage *p;
+  for (p = all_mapped_pages; p; p = p->next)
+    f(p->addr);
+}
+
 void pagemap_for_each(page_callback f) {
   mpage *p, *next;
   p = all_mapped_pages;
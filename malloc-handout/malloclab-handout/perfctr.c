@@ -0,0 +1,119 @@
+/*
+ * perfctr.c - hardware performance counters around the speed runs
+ *
+ * Each event is a separate perf_event_open counter on this thread,
+ * user space only. Events the kernel refuses (no PMU in a VM, seccomp
+ * in a container, perf_event_paranoid) are simply left out, and if the
+ * kernel multiplexes the counters their counts are scaled up to the
+ * full run.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "perfctr.h"
+
+#define CACHE_EVENT(cache, op, result) \
+    ((cache) | ((op) << 8) | ((result) << 16))
+
+static struct {
+    uint32_t type;
+    uint64_t config;
+} events[PERF_NCOUNTERS] = {
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { PERF_TYPE_HW_CACHE, CACHE_EVENT(PERF_COUNT_HW_CACHE_L1D,
+				      PERF_COUNT_HW_CACHE_OP_READ,
+				      PERF_COUNT_HW_CACHE_RESULT_MISS) },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    { PERF_TYPE_HW_CACHE, CACHE_EVENT(PERF_COUNT_HW_CACHE_DTLB,
+				      PERF_COUNT_HW_CACHE_OP_READ,
+				      PERF_COUNT_HW_CACHE_RESULT_MISS) },
+    { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+};
+
+static int fds[PERF_NCOUNTERS] = { -1, -1, -1, -1, -1, -1 };
+
+/*
+ * perfctr_open - open every counter we can, returning how many opened;
+ *     the reason the last one failed is left in errno
+ */
+int perfctr_open(void)
+{
+    struct perf_event_attr attr;
+    int i, n = 0;
+
+    for (i = 0; i < PERF_NCOUNTERS; i++) {
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = events[i].type;
+	attr.config = events[i].config;
+	attr.disabled = 1;
+	attr.exclude_kernel = (events[i].type != PERF_TYPE_SOFTWARE);
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED 
+	    | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	if (fds[i] >= 0)
+	    n++;
+    }
+    return n;
+}
+
+/*
+ * perfctr_close - close the open counters
+ */
+void perfctr_close(void)
+{
+    int i;
+
+    for (i = 0; i < PERF_NCOUNTERS; i++)
+	if (fds[i] >= 0) {
+	    close(fds[i]);
+	    fds[i] = -1;
+	}
+}
+
+int perfctr_available(int event)
+{
+    return fds[event] >= 0;
+}
+
+/*
+ * perfctr_start - zero and start the open counters
+ */
+void perfctr_start(void)
+{
+    int i;
+
+    for (i = 0; i < PERF_NCOUNTERS; i++)
+	if (fds[i] >= 0) {
+	    ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+	    ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+	}
+}
+
+/*
+ * perfctr_stop - stop the open counters and add their counts to acc;
+ *     the caller counts the runs they covered in acc->runs
+ */
+void perfctr_stop(perfctr_t *acc)
+{
+    uint64_t val[3];   /* count, time enabled, time running */
+    int i;
+
+    for (i = 0; i < PERF_NCOUNTERS; i++)
+	if (fds[i] >= 0)
+	    ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+    for (i = 0; i < PERF_NCOUNTERS; i++) {
+	if (fds[i] < 0 || read(fds[i], val, sizeof(val)) != sizeof(val))
+	    continue;
+	if (val[2] > 0)
+	    acc->count[i] += (double)val[0] * val[1] / val[2];
+    }
+}
@@ -0,0 +1,31 @@
+#ifndef __PERFCTR_H_
+#define __PERFCTR_H_
+
+/*
+ * perfctr.h - hardware performance counters around the speed runs
+ */
+
+/* The events we count, in the order the driver prints them */
+enum {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_L1D_MISSES,
+    PERF_LLC_MISSES,
+    PERF_DTLB_MISSES,
+    PERF_PAGE_FAULTS,
+    PERF_NCOUNTERS
+};
+
+/* Counts summed over some number of runs */
+typedef struct {
+    double count[PERF_NCOUNTERS];
+    int runs;
+} perfctr_t;
+
+int perfctr_open(void);
+void perfctr_close(void);
+int perfctr_available(int event);
+void perfctr_start(void);
+void perfctr_stop(perfctr_t *acc);
+
+#endif /* __PERFCTR_H_ */
@@ -0,0 +1,427 @@
+/*
+ * trace.c - reading and writing malloc lab trace files
+ *
+ * read_trace accepts both formats: a file starting with TRACE_MAGIC is
+ * mapped into memory and used in place, anything else is parsed as a
+ * text trace.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+
+#define MAXLINE     1024 /* max string size */
+
+extern int verbose; /* -v option of the program using us */
+
+static void read_trace_rep(trace_t *trace, FILE *tracefile, char *path);
+static void read_trace_bin(trace_t *trace, FILE *tracefile, char *path);
+static void check_header(trace_t *hdr, char *path);
+static void check_ops(traceop_t *ops, int n, int first, int num_ids, 
+		      char *path);
+static void trace_error(char *msg);
+
+/*
+ * read_trace - read a trace file and store it in memory
+ */
+trace_t *read_trace(char *tracedir, char *filename)
+{
+    FILE *tracefile;
+    trace_t *trace;
+    char path[MAXLINE];
+    char msg[MAXLINE];
+    char magic[sizeof(((trace_header_t *)0)->magic)];
+
+    if (verbose > 1)
+	printf("Reading tracefile: %s\n", filename);
+
+    /* Allocate the trace record */
+    if ((trace = (trace_t *) calloc(1, sizeof(trace_t))) == NULL)
+	trace_error("malloc 1 failed in read_trace");
+	
+    strcpy(path, tracedir);
+    strcat(path, filename);
+    if ((tracefile = fopen(path, "r")) == NULL) {
+	sprintf(msg, "Could not open %s in read_trace", path);
+	trace_error(msg);
+    }
+
+    if (fread(magic, 1, sizeof(magic), tracefile) == sizeof(magic)
+	&& memcmp(magic, TRACE_MAGIC, sizeof(magic)) == 0) {
+	read_trace_bin(trace, tracefile, path);
+    } else {
+	rewind(tracefile);
+	read_trace_rep(trace, tracefile, path);
+    }
+    fclose(tracefile);
+
+    /* We'll keep an array of pointers to the allocated blocks here... */
+    if ((trace->blocks = 
+	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
+	trace_error("malloc 3 failed in read_trace");
+
+    /* ... along with the corresponding byte sizes of each block */
+    if ((trace->block_sizes = 
+	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
+	trace_error("malloc 4 failed in read_trace");
+    
+    return trace;
+}
+
+/*
+ * read_trace_rep - parse the header and every request line of a text trace
+ */
+static void read_trace_rep(trace_t *trace, FILE *tracefile, char *path)
+{
+    char type[MAXLINE];
+    unsigned index, size;
+    unsigned max_index = 0;
+    unsigned op_index;
+
+    char msg[MAXLINE + 64];
+
+    /* Read the trace file header */
+    if (fscanf(tracefile, "%d %d %d %d", &trace->sugg_heapsize, 
+	       &trace->num_ids, &trace->num_ops, &trace->weight) != 4) {
+	snprintf(msg, sizeof(msg), "Bad header in tracefile %s", path);
+	errno = EINVAL;
+	trace_error(msg);
+    }
+    check_header(trace, path);
+    
+    /* We'll store each request line in the trace in this array */
+    if ((trace->ops = 
+	 (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
+	trace_error("malloc 2 failed in read_trace");
+
+    /* read every request line in the trace file */
+    index = 0;
+    op_index = 0;
+    while (fscanf(tracefile, "%s", type) != EOF) {
+	if (op_index == trace->num_ops) {
+	    snprintf(msg, sizeof(msg), "Tracefile %s has more than the %d "
+		     "requests its header says", path, trace->num_ops);
+	    errno = EINVAL;
+	    trace_error(msg);
+	}
+	switch(type[0]) {
+	case 'a':
+	    fscanf(tracefile, "%u %u", &index, &size);
+	    trace->ops[op_index].type = ALLOC;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].size = size;
+	    max_index = (index > max_index) ? index : max_index;
+	    break;
+	case 'r':
+	    fscanf(tracefile, "%u %u", &index, &size);
+	    trace->ops[op_index].type = REALLOC;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].size = size;
+	    max_index = (index > max_index) ? index : max_index;
+	    break;
+	case 'f':
+	    fscanf(tracefile, "%ud", &index);
+	    trace->ops[op_index].type = FREE;
+	    trace->ops[op_index].index = index;
+	    break;
+	default:
+	    printf("Bogus type character (%c) in tracefile %s\n", 
+		   type[0], path);
+	    exit(1);
+	}
+	op_index++;
+	
+    }
+    if (op_index != trace->num_ops || max_index != trace->num_ids - 1) {
+	snprintf(msg, sizeof(msg), "Tracefile %s has %u requests and ids up "
+		 "to %u, not the %d and %d its header says", path, op_index, 
+		 max_index, trace->num_ops, trace->num_ids - 1);
+	errno = EINVAL;
+	trace_error(msg);
+    }
+    check_ops(trace->ops, trace->num_ops, 0, trace->num_ids, path);
+}
+
+/*
+ * read_trace_bin - map a binary trace; the requests are used where they
+ *     lie in the mapping, without parsing or copying
+ */
+static void read_trace_bin(trace_t *trace, FILE *tracefile, char *path)
+{
+    struct stat st;
+    trace_header_t *hdr;
+    char msg[MAXLINE];
+
+    if (fstat(fileno(tracefile), &st) < 0) {
+	sprintf(msg, "Could not stat %s in read_trace", path);
+	trace_error(msg);
+    }
+
+    trace->map_len = st.st_size;
+    trace->map = mmap(NULL, trace->map_len, PROT_READ, MAP_PRIVATE,
+		      fileno(tracefile), 0);
+    if (trace->map == MAP_FAILED) {
+	sprintf(msg, "Could not map %s in read_trace", path);
+	trace_error(msg);
+    }
+
+    hdr = trace->map;
+    trace->sugg_heapsize = hdr->sugg_heapsize;
+    trace->num_ids = hdr->num_ids;
+    trace->num_ops = hdr->num_ops;
+    trace->weight = hdr->weight;
+    trace->ops = (traceop_t *)(hdr + 1);
+
+    check_header(trace, path);
+    if (trace->map_len != sizeof(*hdr) + trace->num_ops * sizeof(traceop_t)) {
+	printf("Truncated binary tracefile %s\n", path);
+	exit(1);
+    }
+    check_ops(trace->ops, trace->num_ops, 0, trace->num_ids, path);
+}
+
+/*
+ * check_header - exit unless the header of a trace has sane counts
+ */
+static void check_header(trace_t *hdr, char *path)
+{
+    if (hdr->num_ids < 0 || hdr->num_ops < 0 || hdr->sugg_heapsize < 0) {
+	printf("Bad header in tracefile %s\n", path);
+	exit(1);
+    }
+}
+
+/*
+ * check_ops - exit unless each of n requests, the first of them request
+ *     number first, has a known type, an id below num_ids and a
+ *     non-negative size, so the driver can index its block table with
+ *     them unchecked
+ */
+static void check_ops(traceop_t *ops, int n, int first, int num_ids, 
+		      char *path)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+	if (ops[i].type != ALLOC && ops[i].type != FREE 
+	    && ops[i].type != REALLOC) {
+	    printf("Bogus type (%d) in request %d of tracefile %s\n",
+		   (int)ops[i].type, first + i, path);
+	    exit(1);
+	}
+	if (ops[i].index < 0 || ops[i].index >= num_ids) {
+	    printf("Request %d of tracefile %s has id %d, past the %d ids\n",
+		   first + i, path, ops[i].index, num_ids);
+	    exit(1);
+	}
+	if (ops[i].type != FREE && ops[i].size < 0) {
+	    printf("Request %d of tracefile %s has negative size %d\n",
+		   first + i, path, ops[i].size);
+	    exit(1);
+	}
+    }
+}
+
+/*
+ * free_trace - Free the trace record and the three arrays it points
+ *              to, all of which were allocated in read_trace().
+ */
+void free_trace(trace_t *trace)
+{
+    if (trace->map)           /* unmap the requests of a binary trace... */
+	munmap(trace->map, trace->map_len);
+    else                      /* ... or free the three arrays... */
+	free(trace->ops);
+    free(trace->blocks);      
+    free(trace->block_sizes);
+    free(trace);              /* and the trace record itself... */
+}
+
+/*
+ * open_trace_stream - open a trace to be read a window at a time by
+ *     read_trace_window, reading only its header now
+ */
+trace_stream_t *open_trace_stream(char *tracedir, char *filename)
+{
+    trace_stream_t *s;
+    trace_header_t hdr;
+    struct stat st;
+    char path[MAXLINE];
+    char msg[MAXLINE + 64];
+
+    if ((s = (trace_stream_t *) calloc(1, sizeof(trace_stream_t))) == NULL)
+	trace_error("malloc failed in open_trace_stream");
+    snprintf(path, sizeof(path), "%s%s", tracedir, filename);
+    if ((s->file = fopen(path, "r")) == NULL) {
+	snprintf(msg, sizeof(msg), "Could not open %s in open_trace_stream", 
+		 path);
+	trace_error(msg);
+    }
+    s->path = strdup(path);
+
+    if (fread(&hdr, sizeof(hdr), 1, s->file) == 1
+	&& memcmp(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic)) == 0) {
+	s->binary = 1;
+	s->hdr.sugg_heapsize = hdr.sugg_heapsize;
+	s->hdr.num_ids = hdr.num_ids;
+	s->hdr.num_ops = hdr.num_ops;
+	s->hdr.weight = hdr.weight;
+	check_header(&s->hdr, path);
+	if (fstat(fileno(s->file), &st) < 0 || st.st_size != 
+	    sizeof(hdr) + (off_t)s->hdr.num_ops * sizeof(traceop_t)) {
+	    printf("Truncated binary tracefile %s\n", path);
+	    exit(1);
+	}
+    } else {
+	rewind(s->file);
+	if (fscanf(s->file, "%d %d %d %d", &s->hdr.sugg_heapsize, 
+		   &s->hdr.num_ids, &s->hdr.num_ops, &s->hdr.weight) != 4) {
+	    printf("Bad header in tracefile %s\n", path);
+	    exit(1);
+	}
+	check_header(&s->hdr, path);
+	if ((s->buf = malloc(TRACE_WINDOW_OPS * sizeof(traceop_t))) == NULL)
+	    trace_error("malloc failed in open_trace_stream");
+    }
+    return s;
+}
+
+/*
+ * read_trace_window - point *ops at the next window of up to
+ *     TRACE_WINDOW_OPS requests, returning how many it holds (0 at the
+ *     end). A binary trace is mapped one window at a time, so the
+ *     previous window is unmapped and its pages can be dropped.
+ */
+int read_trace_window(trace_stream_t *s, traceop_t **ops)
+{
+    int n = s->hdr.num_ops - s->next;
+    off_t start, base;
+    size_t page = sysconf(_SC_PAGESIZE);
+    char type[MAXLINE];
+    unsigned index, size;
+    int i;
+
+    if (n > TRACE_WINDOW_OPS)
+	n = TRACE_WINDOW_OPS;
+    if (n <= 0)
+	return 0;
+
+    if (s->binary) {
+	if (s->map)
+	    munmap(s->map, s->map_len);
+	start = sizeof(trace_header_t) + (off_t)s->next * sizeof(traceop_t);
+	base = start & ~(off_t)(page - 1);
+	s->map_len = start - base + n * sizeof(traceop_t);
+	s->map = mmap(NULL, s->map_len, PROT_READ, MAP_PRIVATE, 
+		      fileno(s->file), base);
+	if (s->map == MAP_FAILED) {
+	    s->map = NULL;
+	    trace_error("Could not map trace window in read_trace_window");
+	}
+	madvise(s->map, s->map_len, MADV_SEQUENTIAL);
+	madvise(s->map, s->map_len, MADV_WILLNEED);
+	*ops = (traceop_t *)((char *)s->map + (start - base));
+    } else {
+	for (i = 0; i < n; i++) {
+	    if (fscanf(s->file, "%s", type) != 1) {
+		printf("Truncated tracefile %s\n", s->path);
+		exit(1);
+	    }
+	    switch (type[0]) {
+	    case 'a':
+	    case 'r':
+		fscanf(s->file, "%u %u", &index, &size);
+		s->buf[i].type = (type[0] == 'a') ? ALLOC : REALLOC;
+		s->buf[i].index = index;
+		s->buf[i].size = size;
+		break;
+	    case 'f':
+		fscanf(s->file, "%u", &index);
+		s->buf[i].type = FREE;
+		s->buf[i].index = index;
+		break;
+	    default:
+		printf("Bogus type character (%c) in tracefile %s\n", 
+		       type[0], s->path);
+		exit(1);
+	    }
+	}
+	if (s->next + n == s->hdr.num_ops && fscanf(s->file, "%s", type) == 1) {
+	    printf("Tracefile %s has more than the %d requests its header "
+		   "says\n", s->path, s->hdr.num_ops);
+	    exit(1);
+	}
+	*ops = s->buf;
+    }
+    check_ops(*ops, n, s->next, s->hdr.num_ids, s->path);
+    s->next += n;
+    return n;
+}
+
+void close_trace_stream(trace_stream_t *s)
+{
+    if (s->map)
+	munmap(s->map, s->map_len);
+    fclose(s->file);
+    free(s->buf);
+    free(s->path);
+    free(s);
+}
+
+/*
+ * write_trace_rep - write a trace in the text format
+ */
+void write_trace_rep(FILE *out, trace_t *trace)
+{
+    int i;
+
+    fprintf(out, "%d\n%d\n%d\n%d\n", trace->sugg_heapsize, trace->num_ids,
+	    trace->num_ops, trace->weight);
+    for (i = 0; i < trace->num_ops; i++) {
+	switch (trace->ops[i].type) {
+	case ALLOC:
+	    fprintf(out, "a %d %d\n", trace->ops[i].index, trace->ops[i].size);
+	    break;
+	case REALLOC:
+	    fprintf(out, "r %d %d\n", trace->ops[i].index, trace->ops[i].size);
+	    break;
+	case FREE:
+	    fprintf(out, "f %d\n", trace->ops[i].index);
+	    break;
+	}
+    }
+}
+
+/*
+ * write_trace_bin - write a trace in the binary format
+ */
+void write_trace_bin(FILE *out, trace_t *trace)
+{
+    trace_header_t hdr;
+
+    memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+    hdr.sugg_heapsize = trace->sugg_heapsize;
+    hdr.num_ids = trace->num_ids;
+    hdr.num_ops = trace->num_ops;
+    hdr.weight = trace->weight;
+    if (fwrite(&hdr, sizeof(hdr), 1, out) != 1
+	|| fwrite(trace->ops, sizeof(traceop_t), trace->num_ops, out)
+	   != (size_t)trace->num_ops)
+	trace_error("write failed in write_trace_bin");
+}
+
+/* 
+ * trace_error - Report a Unix-style error
+ */
+static void trace_error(char *msg) 
+{
+    printf("%s: %s\n", msg, strerror(errno));
+    exit(1);
+}
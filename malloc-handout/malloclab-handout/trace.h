@@ -0,0 +1,75 @@
+#ifndef __TRACE_H_
+#define __TRACE_H_
+
+/*
+ * trace.h - reading and writing malloc lab trace files
+ *
+ * A trace is either the text (.rep) format described in traces/README
+ * or the binary format below, which read_trace maps straight into
+ * memory: a fixed header followed by num_ops packed traceop_t records.
+ */
+#include <stdio.h>
+#include <stdint.h>
+
+/* Characterizes a single trace operation (allocator request) */
+typedef struct {
+    enum {ALLOC, FREE, REALLOC} type; /* type of request */
+    int index;                        /* index for free() to use later */
+    int size;                         /* byte size of alloc/realloc request */
+} traceop_t;
+
+/* Holds the information for one trace file*/
+typedef struct {
+    int sugg_heapsize;   /* suggested heap size (unused) */
+    int num_ids;         /* number of alloc/realloc ids */
+    int num_ops;         /* number of distinct requests */
+    int weight;          /* weight for this trace (unused) */
+    traceop_t *ops;      /* array of requests */
+    char **blocks;       /* array of ptrs returned by malloc/realloc... */
+    size_t *block_sizes; /* ... and a corresponding array of payload sizes */
+    void *map;           /* mapping of a binary trace file, or NULL */
+    size_t map_len;      /* ... and its length */
+} trace_t;
+
+/* Header of a binary trace file */
+#define TRACE_MAGIC "MMTRACE1"
+
+typedef struct {
+    char magic[8];         /* TRACE_MAGIC, not NUL-terminated */
+    int32_t sugg_heapsize;
+    int32_t num_ids;
+    int32_t num_ops;
+    int32_t weight;
+} trace_header_t;
+
+/* The binary format stores traceop_t records as they are in memory */
+_Static_assert(sizeof(traceop_t) == 12, "traceop_t must be 12 packed bytes");
+
+trace_t *read_trace(char *tracedir, char *filename);
+void free_trace(trace_t *trace);
+
+/* 
+ * A trace read a window of requests at a time, for traces too large to
+ * hold in memory. Only the header fields of its trace_t are filled in.
+ */
+#define TRACE_WINDOW_OPS (1 << 20)  /* requests per window */
+
+typedef struct {
+    trace_t hdr;         /* header fields of the trace */
+    FILE *file;
+    int binary;          /* binary (mapped) or text (parsed) trace */
+    int next;            /* index of the first request of the next window */
+    void *map;           /* binary: mapping of the current window... */
+    size_t map_len;      /* ... and its length */
+    traceop_t *buf;      /* text: requests parsed for the current window */
+    char *path;
+} trace_stream_t;
+
+trace_stream_t *open_trace_stream(char *tracedir, char *filename);
+int read_trace_window(trace_stream_t *s, traceop_t **ops);
+void close_trace_stream(trace_stream_t *s);
+
+void write_trace_rep(FILE *out, trace_t *trace);
+void write_trace_bin(FILE *out, trace_t *trace);
+
+#endif /* __TRACE_H_ */
@@ -0,0 +1,67 @@
+/*
+ * trconv.c - convert malloc lab traces between the text (.rep) and
+ *     binary formats
+ *
+ *	unix> trconv traces/amptjp-bal.rep amptjp-bal.bin
+ *	unix> trconv -t amptjp-bal.bin amptjp-bal.rep
+ *
+ * The input format is detected from its first bytes.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include "trace.h"
+
+int verbose = 0; /* read by trace.c */
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: trconv [-ht] <in> <out>\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-t         Write a text (.rep) trace instead of binary.\n");
+}
+
+int main(int argc, char **argv)
+{
+    int c, text = 0;
+    trace_t *trace;
+    FILE *out;
+
+    while ((c = getopt(argc, argv, "ht")) != EOF) {
+	switch (c) {
+	case 't':
+	    text = 1;
+	    break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+    if (argc - optind != 2) {
+	usage();
+	exit(1);
+    }
+
+    trace = read_trace("", argv[optind]);
+    if ((out = fopen(argv[optind+1], "w")) == NULL) {
+	printf("Could not open %s: %s\n", argv[optind+1], strerror(errno));
+	exit(1);
+    }
+    if (text)
+	write_trace_rep(out, trace);
+    else
+	write_trace_bin(out, trace);
+    if (fclose(out) != 0) {
+	printf("Could not write %s: %s\n", argv[optind+1], strerror(errno));
+	exit(1);
+    }
+    free_trace(trace);
+    return 0;
+}
@@ -0,0 +1,123 @@
+/*
+ * trscale.c - scale a malloc lab trace up into a larger one
+ *
+ *	unix> trscale -n 100 traces/amptjp-bal.rep amptjp-x100.rep
+ *	unix> trscale -b -n 1000 -m 4 traces/binary2-bal.rep binary2-big.bin
+ *
+ * The output interleaves n copies of the input, taking k requests from
+ * each copy in turn. Copy c renumbers block id i as c * num_ids + i, so
+ * the copies never share blocks and each stays balanced if the input
+ * is. With -m, every request size is multiplied by the given factor.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+
+#include "trace.h"
+
+int verbose = 0; /* read by trace.c */
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: trscale [-hb] [-n <copies>] [-k <ops>] [-m <factor>] <in> <out>\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-b         Write a binary trace instead of text (.rep).\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-k <ops>   Requests taken from a copy per turn (default 1).\n");
+    fprintf(stderr, "\t-m <f>     Multiply every request size by <f> (default 1).\n");
+    fprintf(stderr, "\t-n <n>     Number of copies to interleave (default 2).\n");
+}
+
+int main(int argc, char **argv)
+{
+    int c, binary = 0, copies = 2, run = 1, copy, i, j, end;
+    double factor = 1, size, heapsize;
+    trace_t *in, out;
+    traceop_t *op;
+    FILE *f;
+
+    while ((c = getopt(argc, argv, "hbn:k:m:")) != EOF) {
+	switch (c) {
+	case 'b':
+	    binary = 1;
+	    break;
+	case 'n':
+	    copies = atoi(optarg);
+	    break;
+	case 'k':
+	    run = atoi(optarg);
+	    break;
+	case 'm':
+	    factor = atof(optarg);
+	    break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+    if (argc - optind != 2 || copies < 1 || run < 1 || factor <= 0) {
+	usage();
+	exit(1);
+    }
+
+    in = read_trace("", argv[optind]);
+    if (in->num_ops > INT_MAX / copies || in->num_ids > INT_MAX / copies) {
+	printf("%d copies of %s would have more than %d requests or ids\n",
+	       copies, argv[optind], INT_MAX);
+	exit(1);
+    }
+
+    memset(&out, 0, sizeof(out));
+    out.num_ids = in->num_ids * copies;
+    out.num_ops = in->num_ops * copies;
+    out.weight = in->weight;
+    heapsize = (double)in->sugg_heapsize * copies * factor;
+    out.sugg_heapsize = (heapsize > INT_MAX) ? INT_MAX : (int)heapsize;
+    if ((out.ops = malloc((size_t)out.num_ops * sizeof(traceop_t))) == NULL) {
+	printf("malloc failed in main: %s\n", strerror(errno));
+	exit(1);
+    }
+
+    /* Take run requests from each copy in turn */
+    op = out.ops;
+    for (i = 0; i < in->num_ops; i += run) {
+	end = (i + run < in->num_ops) ? i + run : in->num_ops;
+	for (copy = 0; copy < copies; copy++) {
+	    for (j = i; j < end; j++, op++) {
+		*op = in->ops[j];
+		op->index += copy * in->num_ids;
+		if (op->type == FREE)
+		    continue;
+		size = op->size * factor;
+		if (size > INT_MAX) {
+		    printf("Request %d of %s is too large times %g\n",
+			   j, argv[optind], factor);
+		    exit(1);
+		}
+		op->size = (size < 1) ? 1 : (int)size;
+	    }
+	}
+    }
+
+    if ((f = fopen(argv[optind+1], "w")) == NULL) {
+	printf("Could not open %s: %s\n", argv[optind+1], strerror(errno));
+	exit(1);
+    }
+    if (binary)
+	write_trace_bin(f, &out);
+    else
+	write_trace_rep(f, &out);
+    if (fclose(f) != 0) {
+	printf("Could not write %s: %s\n", argv[optind+1], strerror(errno));
+	exit(1);
+    }
+    free(out.ops);
+    free_trace(in);
+    return 0;
+}
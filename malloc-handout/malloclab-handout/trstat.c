@@ -0,0 +1,324 @@
+/*
+ * trstat.c - describe the shape of a malloc lab trace
+ *
+ *	unix> trstat traces/amptjp-bal.rep
+ *	unix> trstat -n 20 big.bin > big.json
+ *
+ * Reads a text or binary trace with read_trace and writes a JSON object
+ * to stdout with its request counts, the histogram and percentiles of
+ * the request sizes and the most common sizes, the lifetimes of blocks
+ * in requests from their allocation to their free, the peak live bytes
+ * and blocks, and how much each realloc grows or shrinks its block.
+ *
+ * Histograms have power-of-two buckets: lo..hi is 0..0, then 1..1,
+ * 2..3, 4..7 and so on. Only the buckets from the first non-empty one
+ * to the last are written.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include "trace.h"
+
+int verbose = 0; /* read by trace.c */
+
+#define BUCKETS 64
+
+/* A power-of-two histogram of counts and the bytes they add up to */
+typedef struct {
+    long count[BUCKETS];
+    double bytes[BUCKETS];
+} loghist_t;
+
+/* How many requests asked for one size */
+typedef struct {
+    int size;
+    long count;
+} sizecount_t;
+
+/* Buckets of realloc growth, new size over old; see growth_bucket */
+static const char *growth_name[] = {
+    "<=0.5", "0.5-1", "1", "1-1.25", "1.25-1.5", "1.5-2", "2-4", ">4"
+};
+#define GROWTH_BUCKETS (sizeof(growth_name) / sizeof(growth_name[0]))
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: trstat [-h] [-n <top>] <trace>\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-n <top>   Number of most common sizes to list (default 10).\n");
+}
+
+static void *xmalloc(size_t bytes)
+{
+    void *p;
+
+    if ((p = malloc(bytes ? bytes : 1)) == NULL) {
+	printf("malloc failed in trstat: %s\n", strerror(errno));
+	exit(1);
+    }
+    return p;
+}
+
+/* bucket - the power-of-two bucket holding v */
+static int bucket(long v)
+{
+    return v <= 0 ? 0 : 64 - __builtin_clzl((unsigned long)v);
+}
+
+/* growth_bucket - the growth_name bucket of a realloc growth ratio */
+static unsigned growth_bucket(double ratio)
+{
+    static const double edge[] = {1.25, 1.5, 2.0, 4.0};
+    unsigned g;
+
+    if (ratio <= 0.5)
+	return 0;
+    if (ratio < 1)
+	return 1;
+    if (ratio == 1)
+	return 2;
+    for (g = 0; g < 4 && ratio > edge[g]; g++)
+	;
+    return 3 + g;
+}
+
+static void loghist_add(loghist_t *h, long v)
+{
+    h->count[bucket(v)]++;
+    h->bytes[bucket(v)] += v;
+}
+
+static int cmp_int(const void *a, const void *b)
+{
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+/* most common first, and the smaller size first among equals */
+static int cmp_count(const void *a, const void *b)
+{
+    const sizecount_t *x = a, *y = b;
+
+    if (x->count != y->count)
+	return (x->count < y->count) - (x->count > y->count);
+    return (x->size > y->size) - (x->size < y->size);
+}
+
+/* percentile - the value of a sorted array below which pct percent lie */
+static int percentile(int *sorted, long n, double pct)
+{
+    long rank = (long)(pct / 100.0 * n + 0.5);
+
+    if (n == 0)
+	return 0;
+    if (rank < 1)
+	rank = 1;
+    return sorted[rank - 1];
+}
+
+/*
+ * print_dist - write the mean, percentiles and histogram of n sorted
+ *     values as the body of a JSON object
+ */
+static void print_dist(int *sorted, long n, loghist_t *h, int with_bytes)
+{
+    double sum = 0;
+    long i;
+    int b, first = -1, last = -1;
+
+    for (i = 0; i < n; i++)
+	sum += sorted[i];
+    printf("\"count\": %ld, \"min\": %d, \"max\": %d, \"mean\": %.2f,\n",
+	   n, n ? sorted[0] : 0, n ? sorted[n-1] : 0, n ? sum / n : 0.0);
+    printf("    \"p50\": %d, \"p90\": %d, \"p99\": %d, \"p999\": %d,\n",
+	   percentile(sorted, n, 50), percentile(sorted, n, 90),
+	   percentile(sorted, n, 99), percentile(sorted, n, 99.9));
+    printf("    \"histogram\": [");
+    for (b = 0; b < BUCKETS; b++) {
+	if (h->count[b] == 0)
+	    continue;
+	if (first < 0)
+	    first = b;
+	last = b;
+    }
+    for (b = first; first >= 0 && b <= last; b++) {
+	printf("%s\n      {\"lo\": %ld, \"hi\": %ld, \"count\": %ld",
+	       b == first ? "" : ",", b ? 1L << (b-1) : 0L,
+	       b ? (1L << b) - 1 : 0L, h->count[b]);
+	if (with_bytes)
+	    printf(", \"bytes\": %.0f", h->bytes[b]);
+	printf("}");
+    }
+    printf("]");
+}
+
+static void print_string(char *s)
+{
+    putchar('"');
+    for (; *s; s++)
+	printf((*s == '"' || *s == '\\') ? "\\%c" : "%c", *s);
+    putchar('"');
+}
+
+int main(int argc, char **argv)
+{
+    int c, top = 10, i, id, size, oldsize;
+    long allocs = 0, reallocs = 0, frees = 0, nsizes = 0, nlives = 0;
+    long live_blocks = 0, peak_blocks = 0, nunique, growths = 0;
+    long growth_count[GROWTH_BUCKETS] = {0};
+    double live_bytes = 0, peak_bytes = 0, requested = 0, ratio;
+    double log_growth = 0, min_growth = 0, max_growth = 0;
+    int peak_bytes_op = -1, peak_blocks_op = -1, never_freed;
+    int *born, *cur, *sizes, *lives;
+    unsigned g;
+    sizecount_t *counts;
+    loghist_t size_hist, life_hist;
+    trace_t *trace;
+    traceop_t *op;
+
+    while ((c = getopt(argc, argv, "hn:")) != EOF) {
+	switch (c) {
+	case 'n':
+	    top = atoi(optarg);
+	    break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+    if (argc - optind != 1 || top < 0) {
+	usage();
+	exit(1);
+    }
+
+    trace = read_trace("", argv[optind]);
+    born = xmalloc(trace->num_ids * sizeof(int));  /* op of alloc, or -1 */
+    cur = xmalloc(trace->num_ids * sizeof(int));   /* current size */
+    sizes = xmalloc(trace->num_ops * sizeof(int)); /* every requested size */
+    lives = xmalloc(trace->num_ops * sizeof(int)); /* every lifetime */
+    for (id = 0; id < trace->num_ids; id++)
+	born[id] = -1;
+    memset(&size_hist, 0, sizeof(size_hist));
+    memset(&life_hist, 0, sizeof(life_hist));
+
+    for (i = 0, op = trace->ops; i < trace->num_ops; i++, op++) {
+	id = op->index;
+	switch (op->type) {
+	case ALLOC:
+	    allocs++;
+	    born[id] = i;
+	    cur[id] = op->size;
+	    live_bytes += op->size;
+	    live_blocks++;
+	    break;
+	case REALLOC:
+	    reallocs++;
+	    oldsize = (born[id] < 0) ? 0 : cur[id];
+	    if (born[id] < 0) {
+		born[id] = i;
+		live_blocks++;
+	    }
+	    else if (oldsize > 0 && op->size > 0) {
+		ratio = (double)op->size / oldsize;
+		growth_count[growth_bucket(ratio)]++;
+		log_growth += log(ratio);
+		if (growths == 0 || ratio < min_growth)
+		    min_growth = ratio;
+		if (growths == 0 || ratio > max_growth)
+		    max_growth = ratio;
+		growths++;
+	    }
+	    cur[id] = op->size;
+	    live_bytes += op->size - oldsize;
+	    break;
+	case FREE:
+	    frees++;
+	    if (born[id] < 0)
+		break;
+	    lives[nlives++] = i - born[id];
+	    loghist_add(&life_hist, i - born[id]);
+	    live_bytes -= cur[id];
+	    live_blocks--;
+	    born[id] = -1;
+	    break;
+	}
+	if (op->type != FREE) {
+	    size = op->size;
+	    sizes[nsizes++] = size;
+	    requested += size;
+	    loghist_add(&size_hist, size);
+	}
+	if (live_bytes > peak_bytes) {
+	    peak_bytes = live_bytes;
+	    peak_bytes_op = i;
+	}
+	if (live_blocks > peak_blocks) {
+	    peak_blocks = live_blocks;
+	    peak_blocks_op = i;
+	}
+    }
+    never_freed = live_blocks;
+
+    qsort(sizes, nsizes, sizeof(int), cmp_int);
+    qsort(lives, nlives, sizeof(int), cmp_int);
+
+    /* Count the distinct sizes, then put the most common first */
+    counts = xmalloc(nsizes * sizeof(sizecount_t));
+    for (nunique = 0, i = 0; i < nsizes; i++) {
+	if (nunique > 0 && counts[nunique-1].size == sizes[i])
+	    counts[nunique-1].count++;
+	else {
+	    counts[nunique].size = sizes[i];
+	    counts[nunique++].count = 1;
+	}
+    }
+    qsort(counts, nunique, sizeof(sizecount_t), cmp_count);
+
+    printf("{\n  \"trace\": ");
+    print_string(argv[optind]);
+    printf(",\n  \"ops\": %d, \"ids\": %d, \"allocs\": %ld, \"reallocs\": %ld, "
+	   "\"frees\": %ld,\n", trace->num_ops, trace->num_ids,
+	   allocs, reallocs, frees);
+    printf("  \"requested_bytes\": %.0f,\n", requested);
+    printf("  \"peak_live\": {\"bytes\": %.0f, \"bytes_op\": %d, "
+	   "\"blocks\": %ld, \"blocks_op\": %d},\n",
+	   peak_bytes, peak_bytes_op, peak_blocks, peak_blocks_op);
+
+    printf("  \"sizes\": {");
+    print_dist(sizes, nsizes, &size_hist, 1);
+    printf(",\n    \"distinct\": %ld, \"top\": [", nunique);
+    for (i = 0; i < top && i < nunique; i++)
+	printf("%s\n      {\"size\": %d, \"count\": %ld, \"share\": %.4f}",
+	       i ? "," : "", counts[i].size, counts[i].count,
+	       (double)counts[i].count / nsizes);
+    printf("]},\n");
+
+    printf("  \"lifetimes\": {\"never_freed\": %d, ", never_freed);
+    print_dist(lives, nlives, &life_hist, 0);
+    printf("},\n");
+
+    printf("  \"realloc_growth\": {\"count\": %ld, \"min\": %.4f, "
+	   "\"max\": %.4f, \"geomean\": %.4f,\n    \"histogram\": [",
+	   growths, min_growth, max_growth,
+	   growths ? exp(log_growth / growths) : 0.0);
+    for (g = 0; g < GROWTH_BUCKETS; g++)
+	printf("%s\n      {\"ratio\": \"%s\", \"count\": %ld}",
+	       g ? "," : "", growth_name[g], growth_count[g]);
+    printf("]}\n}\n");
+
+    free(counts);
+    free(lives);
+    free(sizes);
+    free(cur);
+    free(born);
+    free_trace(trace);
+    return 0;
+}